@@ -0,0 +1,145 @@
+// -------------------------------------------------------------
+// Battery-mode sample buffer for firmware_v4_mesh.cpp
+// -------------------------------------------------------------
+// Packed samples, the ring they wait in across deep sleeps and the JSON
+// batch encoder. Plain C++ with no Arduino dependencies so it also builds
+// on the host (see test/test_battery_buffer.cpp).
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+struct PackedSample {
+  uint32_t t;       // time(), s; the RTC keeps it through deep sleep
+  int16_t  temp10;  // 0.1 C
+  uint16_t dust;    // ug/m3
+  uint16_t mq2;     // ppm
+  uint8_t  hum;     // %RH
+  uint8_t  flags;   // alert bits, as in telemetry
+};
+
+static const int16_t  PACKED_NO_TEMP = INT16_MIN;
+static const uint8_t  PACKED_NO_HUM  = 0xFF;
+static const uint16_t PACKED_NONE    = 0xFFFF;
+static const uint8_t  RTC_BUF_LEN    = 128;   // 1.5 KB of the 8 KB slow memory
+static const uint8_t  BATCH_ROWS     = 12;    // rows per MQTT message
+static const size_t   BATCH_MQTT_BUFFER = 1024;  // mqtt.setBufferSize(): header, topic and payload
+
+// A reading as the sense path has it; NAN / negative means missing
+struct SampleReading {
+  float   temp;
+  float   hum;
+  int32_t dust;
+  int32_t mq2;
+  uint8_t flags;
+};
+
+// Out-of-range values saturate instead of colliding with the markers
+inline PackedSample packSample(uint32_t t, const SampleReading& r) {
+  PackedSample s;
+  s.t = t;
+  if (isnan(r.temp)) {
+    s.temp10 = PACKED_NO_TEMP;
+  } else {
+    long temp10 = lroundf(r.temp * 10);
+    s.temp10 = (int16_t)(temp10 < INT16_MIN + 1 ? INT16_MIN + 1 : (temp10 > INT16_MAX ? INT16_MAX : temp10));
+  }
+  s.hum  = isnan(r.hum) ? PACKED_NO_HUM : (uint8_t)(r.hum < 0 ? 0 : (r.hum > 100 ? 100 : lroundf(r.hum)));
+  s.dust = r.dust < 0 ? PACKED_NONE : (uint16_t)(r.dust >= PACKED_NONE ? PACKED_NONE - 1 : r.dust);
+  s.mq2  = r.mq2 < 0 ? PACKED_NONE : (uint16_t)(r.mq2 >= PACKED_NONE ? PACKED_NONE - 1 : r.mq2);
+  s.flags = r.flags;
+  return s;
+}
+
+inline SampleReading unpackSample(const PackedSample& s) {
+  SampleReading r;
+  r.temp  = s.temp10 == PACKED_NO_TEMP ? NAN : s.temp10 / 10.0f;
+  r.hum   = s.hum == PACKED_NO_HUM ? NAN : (float)s.hum;
+  r.dust  = s.dust == PACKED_NONE ? -1 : s.dust;
+  r.mq2   = s.mq2 == PACKED_NONE ? -1 : s.mq2;
+  r.flags = s.flags;
+  return r;
+}
+
+// Lives in RTC slow memory, so it is an aggregate and clear() stands in
+// for a constructor on a cold boot. When full, a new sample overwrites
+// the oldest one.
+struct SampleRing {
+  PackedSample buf[RTC_BUF_LEN];
+  uint8_t  head;     // next write
+  uint8_t  count;
+  uint32_t dropped;  // overwritten before upload
+
+  void clear() {
+    memset(this, 0, sizeof(*this));
+  }
+
+  void push(const PackedSample& s) {
+    buf[head] = s;
+    head = (head + 1) % RTC_BUF_LEN;
+    if (count < RTC_BUF_LEN) count++;
+    else dropped++;
+  }
+
+  // i = 0 is the oldest sample
+  const PackedSample& at(uint8_t i) const {
+    return buf[(head + RTC_BUF_LEN - count + i) % RTC_BUF_LEN];
+  }
+
+  // The oldest n were delivered
+  void consume(uint8_t n) {
+    count -= n < count ? n : count;
+  }
+};
+
+// [age_s,temp,hum,dust,mq2,flags], null = missing
+inline int encodeRow(const PackedSample& s, uint32_t now, char* out, size_t cap) {
+  char temp[8] = "null", hum[6] = "null", dust[6] = "null", mq2[6] = "null";
+  if (s.temp10 != PACKED_NO_TEMP) {
+    int a = s.temp10 < 0 ? -s.temp10 : s.temp10;
+    snprintf(temp, sizeof(temp), "%s%d.%d", s.temp10 < 0 ? "-" : "", a / 10, a % 10);
+  }
+  if (s.hum != PACKED_NO_HUM) snprintf(hum, sizeof(hum), "%u", s.hum);
+  if (s.dust != PACKED_NONE)  snprintf(dust, sizeof(dust), "%u", s.dust);
+  if (s.mq2 != PACKED_NONE)   snprintf(mq2, sizeof(mq2), "%u", s.mq2);
+  return snprintf(out, cap, "[%lu,%s,%s,%s,%s,%u]",
+                  (unsigned long)(now - s.t), temp, hum, dust, mq2, s.flags);
+}
+
+// Writes <head>"rows":[...]} with as many of the oldest samples as fit
+// both BATCH_ROWS and cap bytes (terminator included). head opens the
+// object and ends with a comma, e.g. {"id":1,. Returns the rows taken
+// and sets len; 0 rows means not even one fits.
+inline uint8_t encodeBatch(const SampleRing& ring, uint32_t now, const char* head,
+                           char* out, size_t cap, size_t& len) {
+  static const char OPEN[] = "\"rows\":[";
+  static const size_t CLOSE = 2;  // "]}"
+
+  len = 0;
+  size_t headLen = strlen(head);
+  if (headLen + sizeof(OPEN) - 1 + CLOSE >= cap) return 0;
+  memcpy(out, head, headLen);
+  memcpy(out + headLen, OPEN, sizeof(OPEN) - 1);
+  size_t pos = headLen + sizeof(OPEN) - 1;
+
+  uint8_t rows = 0;
+  char row[48];
+  while (rows < BATCH_ROWS && rows < ring.count) {
+    int n = encodeRow(ring.at(rows), now, row, sizeof(row));
+    size_t need = (rows ? 1 : 0) + n;
+    if (pos + need + CLOSE >= cap) break;
+    if (rows) out[pos++] = ',';
+    memcpy(out + pos, row, n);
+    pos += n;
+    rows++;
+  }
+  if (rows == 0) return 0;
+
+  out[pos++] = ']';
+  out[pos++] = '}';
+  out[pos] = '\0';
+  len = pos;
+  return rows;
+}
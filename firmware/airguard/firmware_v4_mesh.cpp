@@ -10,6 +10,7 @@
 // - Local automation support
 // - Bluetooth mesh communication
 // - Always shows live sensor data
+// - Optional battery mode: deep sleep between samples, batched uploads
 //
 // NETWORK PRIORITY:
 // 1. Try saved home WiFi (if configured)
@@ -27,10 +28,16 @@
 #include <NTPClient.h>
 #include <WiFiUdp.h>
 #include <Preferences.h>
-#include <DHT.h>
 #include <SPI.h>
 #include <TFT_eSPI.h>
 #include "esp_wifi.h"
+#include "esp_timer.h"
+#include "esp_adc_cal.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include "lwip/sockets.h"
+#include "battery_buffer.h"
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
 #include <BLEDevice.h>
@@ -41,8 +48,7 @@
 // -------------------------------------------------------------
 // Pins
 // -------------------------------------------------------------
-#define DHTPIN               33
-#define DHTTYPE              DHT22
+#define DHTPIN               33   // DHT22
 #define MQ2PIN               32
 #define DUSTPIN              34
 #define DUSTLEDPIN           2
@@ -80,6 +86,10 @@ String topicStatus;
 String topicThresholds;
 String topicCmdBuzzer;
 String topicCmdThresholds;
+String topicFilters;
+String topicCmdFilters;
+String topicBatch;
+String topicCmdPower;
 String mqttClientId;
 
 // BLE Objects
@@ -108,7 +118,292 @@ PubSubClient mqtt(mqttNet);
 // Sensors / Display
 // -------------------------------------------------------------
 TFT_eSPI tft;
-DHT      dht(DHTPIN, DHTTYPE);
+
+// Latest reading of each sensor. Filled in the background by the
+// acquisition state machine; everything else reads it without waiting.
+struct SensorSnapshot {
+  float temp;  // C
+  float hum;   // %RH
+  float dust;  // ug/m3
+  float mq2;   // ppm
+};
+
+SensorSnapshot snapshot = {NAN, NAN, NAN, NAN};
+
+// Each sensor runs on its own schedule and publishes into the snapshot
+// independently; a reading older than maxAgeMs (or two periods, when
+// the governor has slowed it down) is treated as missing so a failing
+// sensor never holds back the others.
+enum SensorId : uint8_t { SENSOR_DHT, SENSOR_DUST, SENSOR_MQ2, SENSOR_COUNT };
+
+struct SensorSchedule {
+  const char* name;
+  uint32_t periodMs;    // native sample rate
+  uint32_t activeMs;    // current period, set by the governor
+  uint32_t latencyMs;   // start-to-result time
+  uint32_t maxAgeMs;
+  uint32_t nextDue;
+  uint32_t sampledAt;   // millis() of the last good sample, 0 = never
+  uint32_t failures;
+};
+
+SensorSchedule schedules[SENSOR_COUNT] = {
+  {"dht",  2000, 2000, 8, 10000, 0, 0, 0},  // DHT22 refuses faster polling; start + ack + 40 bits < 8 ms
+  {"dust",  500,  500, 0,  2000, 0, 0, 0},  // 50 pulses per window
+  {"mq2",   250,  250, 0,  2000, 0, 0, 0},  // one 160 ms burst per period
+};
+
+static const int NO_READING = INT32_MIN + 1;  // distinct from the "never drawn" marker
+
+// Per-channel DSP chain, run on every new sample. Kernels work in fixed
+// point (sensor units x256) on static state; stages apply in order.
+enum FilterKind : uint8_t { FILTER_MEDIAN, FILTER_EMA, FILTER_SLEW, FILTER_SPIKE, FILTER_KIND_COUNT };
+enum FilterChannel : uint8_t { CH_TEMP, CH_HUM, CH_DUST, CH_MQ2, CH_COUNT };
+
+static const char* FILTER_KIND_NAMES[FILTER_KIND_COUNT] = {"median", "ema", "slew", "spike"};
+static const uint8_t FILTER_MAX_STAGES = 4;
+static const uint8_t MEDIAN_MAX_N      = 7;
+static const int32_t FIX_ONE           = 256;  // same Q8 as the conversion tables
+
+struct FilterStage {
+  FilterKind kind;
+  int32_t    param;   // median: N; ema: alpha x256; slew/spike: max step x256
+  int32_t    hist[MEDIAN_MAX_N];
+  uint8_t    count;
+  uint8_t    pos;
+  int32_t    last;
+  bool       primed;
+};
+
+struct FilterChain {
+  const char* name;
+  uint8_t     stageCount;
+  FilterStage stages[FILTER_MAX_STAGES];
+};
+
+FilterChain filters[CH_COUNT] = {{"temp"}, {"hum"}, {"dust"}, {"mq2"}};
+
+static const char* DEFAULT_FILTERS =
+  "{\"temp\":[{\"spike\":3},{\"ema\":0.5}],"
+  "\"hum\":[{\"spike\":10},{\"ema\":0.5}],"
+  "\"dust\":[{\"median\":3},{\"ema\":0.3}],"
+  "\"mq2\":[{\"spike\":300},{\"ema\":0.3}]}";
+
+// Sampling governor: while every channel is flat, sensor periods and
+// the telemetry interval ramp from their fast bound to their slow one;
+// a channel moving faster than its trigger, or any alert, snaps them
+// back. Configured and persisted with the filters.
+struct RateBounds {
+  uint32_t fastMs;
+  uint32_t slowMs;
+};
+
+struct GovernorConfig {
+  RateBounds sensors[SENSOR_COUNT];
+  RateBounds telemetry;
+  float      trigger[CH_COUNT];  // change per minute that counts as an event
+  uint32_t   holdMs;             // stay fast this long after the last event
+  uint32_t   rampMs;             // fast -> slow once the hold has passed
+};
+
+// Telemetry doubles as the hub's presence heartbeat: VeaHub marks a
+// device offline after PRESENCE_TIMEOUT_MS (45 s) of silence, so the
+// slow telemetry bound stays under half of that
+static const uint32_t TELEMETRY_SLOW_MAX_MS = 15000;
+
+GovernorConfig governor = {
+  {{2000, 10000}, {500, 5000}, {250, 2000}},
+  {2000, TELEMETRY_SLOW_MAX_MS},
+  {1.0f, 5.0f, 60.0f, 60.0f},  // C, %RH, ug/m3, ppm
+  30000,
+  60000,
+};
+
+static const uint32_t GOV_WINDOW_MS = 5000;  // slopes are taken over at least this
+
+float    govSlowness = 0;  // 0 = fast bounds, 1 = slow bounds
+uint32_t govEventAt  = 0;
+
+// Filter and governor configs arrive on the net task (MQTT, BLE) while
+// the sense task runs the chains and schedules on the other core. New
+// configs are staged under configMux and the sense task adopts them
+// between passes, so it never runs a half-copied chain.
+portMUX_TYPE     configMux = portMUX_INITIALIZER_UNLOCKED;
+FilterChain      stagedFilters[CH_COUNT];
+GovernorConfig   stagedGovernor;
+volatile uint8_t stagedFilterMask = 0;  // channels with a staged chain
+volatile bool    governorStaged   = false;
+
+// Output-side counters, published with the filter config
+uint32_t cardRedraws = 0;
+uint32_t telemetryPublishes = 0;
+uint32_t alertTransitions = 0;
+
+// -------------------------------------------------------------
+// Conversion Tables
+// -------------------------------------------------------------
+// Calibrated millivolts -> sensor units (x256), generated at compile
+// time from the datasheet curves. The eFuse ADC calibration is per
+// chip, so tables are indexed by calibrated mV rather than raw counts;
+// both steps are integer-only. One lookup + one lerp per sample.
+static const int LUT_SHIFT  = 6;                  // 64 mV between knots
+static const int LUT_POINTS = (3328 >> LUT_SHIFT) + 1;
+
+struct ConversionTable {
+  int32_t q8[LUT_POINTS];
+};
+
+// C++11-compatible constexpr exp/ln (single-return recursion)
+constexpr double LN2 = 0.6931471805599453;
+constexpr double cxSq(double v) { return v * v; }
+constexpr double cxExpSeries(double x, int n, double term, double sum) {
+  return n > 24 ? sum : cxExpSeries(x, n + 1, term * x / n, sum + term * x / n);
+}
+constexpr double cxExp(double x) {
+  return x < 0 ? 1.0 / cxExp(-x) : (x > 0.5 ? cxSq(cxExp(x / 2)) : cxExpSeries(x, 1, 1.0, 1.0));
+}
+constexpr double cxAtanhSeries(double z2, double term, int k, double sum) {
+  return k > 41 ? sum : cxAtanhSeries(z2, term * z2, k + 2, sum + term / k);
+}
+constexpr double cxLn(double x) {
+  return x > 2 ? cxLn(x / 2) + LN2
+       : x < 0.5 ? cxLn(x * 2) - LN2
+       : 2 * cxAtanhSeries(cxSq((x - 1) / (x + 1)), (x - 1) / (x + 1), 1, 0);
+}
+constexpr double cxPow(double b, double e) { return cxExp(e * cxLn(b)); }
+constexpr int32_t cxQ8(double v) { return (int32_t)(v * 256 + 0.5); }
+
+template <int... I> struct IndexSeq {};
+template <int N, int... I> struct MakeIndexSeq : MakeIndexSeq<N - 1, N - 1, I...> {};
+template <int... I> struct MakeIndexSeq<0, I...> { typedef IndexSeq<I...> type; };
+
+// MQ2: datasheet log-log curves, ppm = (Rs/R0 / a)^(1/m). Rs/R0 is
+// taken relative to the clean-air reading (Rs/R0 = 9.83 there), so the
+// load resistor cancels out.
+struct Mq2Curve {
+  double a;  // Rs/R0 at 1 ppm
+  double m;  // log-log slope
+};
+
+constexpr double MQ2_SUPPLY_MV    = 5000;  // heater/divider supply as seen at the ADC pin
+constexpr double MQ2_CLEAN_AIR_MV = 350;   // calibration: reading in clean air
+constexpr double MQ2_MAX_PPM      = 10000;
+
+constexpr Mq2Curve MQ2_SMOKE = {35.6, -0.443};  // 3.4 @ 200 ppm, 0.6 @ 10000 ppm
+constexpr Mq2Curve MQ2_LPG   = {18.7, -0.465};  // 1.6 @ 200 ppm, 0.26 @ 10000 ppm
+
+constexpr double mq2Ratio(double mv) {
+  return 9.83 * ((MQ2_SUPPLY_MV - mv) / mv) / ((MQ2_SUPPLY_MV - MQ2_CLEAN_AIR_MV) / MQ2_CLEAN_AIR_MV);
+}
+constexpr double mq2Ppm(Mq2Curve c, double mv) {
+  return mv <= 0 || mv >= MQ2_SUPPLY_MV ? (mv <= 0 ? 0 : MQ2_MAX_PPM)
+       : cxPow(mq2Ratio(mv) / c.a, 1 / c.m) > MQ2_MAX_PPM ? MQ2_MAX_PPM
+       : cxPow(mq2Ratio(mv) / c.a, 1 / c.m);
+}
+template <int... I>
+constexpr ConversionTable mq2Table(Mq2Curve c, IndexSeq<I...>) {
+  return {{ cxQ8(mq2Ppm(c, (double)(I << LUT_SHIFT)))... }};
+}
+
+// GP2Y1010: 0.5 V per 100 ug/m3 above the no-dust voltage, flat past
+// ~500 ug/m3. The divider variant reads the 5 V output through 10k/20k.
+struct DustCurve {
+  double scale;     // sensor mV per ADC mV
+  double noDustMv;
+  double ugPerMv;
+  double maxUg;
+};
+
+constexpr DustCurve DUST_GP2Y1010         = {1.0, 600, 0.2, 600};
+constexpr DustCurve DUST_GP2Y1010_DIVIDER = {1.5, 600, 0.2, 600};
+
+constexpr double dustUg(DustCurve c, double mv) {
+  return mv * c.scale <= c.noDustMv ? 0
+       : (mv * c.scale - c.noDustMv) * c.ugPerMv > c.maxUg ? c.maxUg
+       : (mv * c.scale - c.noDustMv) * c.ugPerMv;
+}
+template <int... I>
+constexpr ConversionTable dustTable(DustCurve c, IndexSeq<I...>) {
+  return {{ cxQ8(dustUg(c, (double)(I << LUT_SHIFT)))... }};
+}
+
+// Fitted sensor variants
+constexpr ConversionTable MQ2_TABLE  = mq2Table(MQ2_SMOKE, MakeIndexSeq<LUT_POINTS>::type());
+constexpr ConversionTable DUST_TABLE = dustTable(DUST_GP2Y1010, MakeIndexSeq<LUT_POINTS>::type());
+
+static inline int32_t lookupQ8(const ConversionTable& t, uint32_t mv) {
+  if (mv >= (uint32_t)(LUT_POINTS - 1) << LUT_SHIFT) return t.q8[LUT_POINTS - 1];
+  uint32_t i = mv >> LUT_SHIFT;
+  int32_t frac = mv & ((1 << LUT_SHIFT) - 1);
+  return t.q8[i] + (((t.q8[i + 1] - t.q8[i]) * frac) >> LUT_SHIFT);
+}
+
+// DHT22: the host start pulse is timed by esp_timer and the reply is
+// captured as falling-edge timestamps by a GPIO interrupt, so the
+// 5 ms frame is never bit-banged with interrupts masked.
+enum DhtPhase : uint8_t { DHT_IDLE, DHT_START, DHT_CAPTURE };
+
+static const uint8_t  DHT_MAX_EDGES       = 48;
+static const uint32_t DHT_START_LOW_US    = 1100;
+
+volatile DhtPhase dhtPhase = DHT_IDLE;
+volatile uint8_t  dhtEdgeCount = 0;
+volatile uint32_t dhtEdges[DHT_MAX_EDGES];
+uint32_t dhtStartedAt = 0;
+esp_timer_handle_t dhtTimer = nullptr;
+
+// GP2Y1010: a hardware timer ISR runs the sensor's 10 ms pulse train
+// (LED on, sample at 280 us, LED off at 320 us). analogRead() is not
+// ISR-safe, so the conversion is handed to a top-priority task and
+// dropped if it did not finish while the LED was still on. The train
+// runs in bursts, one per dust period, so the chip can light-sleep in
+// between.
+enum DustPhase : uint8_t { DUST_PULSE_START, DUST_SAMPLE, DUST_PULSE_END };
+
+static const uint32_t DUST_PERIOD_US  = 10000;
+static const uint32_t DUST_SAMPLE_US  = 280;
+static const uint32_t DUST_LED_OFF_US = 40;
+static const uint8_t  DUST_MEDIAN_K   = 5;  // pulses per median group
+static const uint8_t  DUST_BURST_PULSES = DUST_MEDIAN_K * 4;  // 200 ms
+
+hw_timer_t*  dustHwTimer = nullptr;
+TaskHandle_t dustTaskHandle = nullptr;
+volatile DustPhase dustPhase = DUST_PULSE_START;
+volatile uint32_t  dustLedOnAt = 0;
+volatile uint8_t   dustBurstLeft = 0;
+
+// adcSamplerTask notification bits
+static const uint32_t ADC_NOTIFY_DUST = 1 << 0;
+static const uint32_t ADC_NOTIFY_MQ2  = 1 << 1;
+
+// Held while a dust or MQ2 burst or a DHT frame is in flight; the timer
+// group and GPIO edges stop in light sleep
+esp_pm_lock_handle_t sensorPmLock = nullptr;
+
+// Group medians accumulated over one reporting window
+portMUX_TYPE dustMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t dustWindowSum = 0;
+uint16_t dustWindowCount = 0;
+uint32_t dustPulses = 0;  // conversions attempted
+uint32_t dustLate = 0;    // dropped for finishing after the LED went off
+
+// MQ2: an esp_timer runs one short burst per MQ2 period, and the same
+// task oversamples between dust pulses into a boxcar ring the burst
+// refills end to end; the mean is converted with the chip's eFuse ADC
+// calibration. ADC1's continuous/DMA mode is not used because it would
+// lock out the dust sensor's timed conversions on the same unit.
+static const uint8_t  MQ2_SAMPLES_PER_TICK = 4;
+static const uint32_t MQ2_TICK_US          = 5000;  // 800 S/s
+static const uint8_t  MQ2_BOX_LEN          = 128;
+static const uint8_t  MQ2_BURST_TICKS      = MQ2_BOX_LEN / MQ2_SAMPLES_PER_TICK;  // 160 ms
+
+uint16_t mq2Ring[MQ2_BOX_LEN];
+uint8_t  mq2RingPos = 0;
+volatile uint32_t mq2BoxSum = 0;
+esp_timer_handle_t mq2Timer = nullptr;
+volatile uint8_t  mq2BurstLeft = 0;
+volatile uint32_t mq2BurstDoneAt = 0;  // millis() at the end of the last burst, 0 = none yet
+esp_adc_cal_characteristics_t adcChars;
 
 // -------------------------------------------------------------
 // Settings
@@ -126,6 +421,9 @@ int dustThreshold = 400;
 int mq2Threshold  = 60;
 int timezoneOffset = 7200;
 bool buzzerEnabled = true;
+bool batteryMode = false;
+uint32_t batteryPeriodS = 300;  // one sample per timer wake
+uint8_t  batteryEvery   = 12;   // samples per upload
 
 // Local automation rules (stored in preferences)
 struct AutomationRule {
@@ -157,7 +455,8 @@ bool beepState = false;
 bool forceThresholdPublish = false;
 bool forceTelemetryPublish = false;
 
-static const uint32_t TELEMETRY_INTERVAL_MS  = 2000;
+volatile uint32_t telemetryIntervalMs = 2000;  // set by the governor
+
 static const uint32_t THRESHOLD_INTERVAL_MS  = 60000;
 static const uint32_t WIFI_RETRY_INTERVAL_MS = 30000;
 
@@ -201,6 +500,86 @@ int lastMq2  = INT32_MIN;
 bool lastAlertState = false;
 bool lastMuteState  = true;
 
+// -------------------------------------------------------------
+// Tasks
+// -------------------------------------------------------------
+// sense: sensors, alerts, buzzer, LEDs, buttons  (high, app core)
+// ui:    TFT, redrawn from the latest report     (medium, app core)
+// net:   WiFi, MQTT, NTP, publishing             (low, protocol core)
+static const UBaseType_t SENSE_TASK_PRIO = 5;
+static const UBaseType_t UI_TASK_PRIO    = 2;
+static const UBaseType_t NET_TASK_PRIO   = 1;
+static const uint32_t SENSE_MAX_WAIT_MS  = 1000;  // stale readings still blank
+static const uint32_t BUTTON_POLL_MS     = 20;    // while a button is down
+static const uint32_t NET_MAX_WAIT_MS    = 200;   // forced publishes wait this long
+static const uint32_t UI_REFRESH_MS      = 500;   // clock/footer without new data
+
+// The sense task sleeps until its next deadline or one of these
+EventGroupHandle_t senseEvents = nullptr;
+static const EventBits_t EV_BUTTON  = BIT0;  // button ISR
+static const EventBits_t EV_RECHECK = BIT1;  // thresholds/buzzer changed elsewhere
+
+// Handed from sense to ui/net. Both queues hold one report and are
+// overwritten, so readers only ever see the latest.
+struct SensorReport {
+  int temp, hum, dust, mq2;  // NO_READING when missing or stale
+  bool alert;
+  bool muted;
+};
+QueueHandle_t uiReports  = nullptr;  // received by ui
+QueueHandle_t netReports = nullptr;  // peeked by net
+SemaphoreHandle_t tftMutex = nullptr;
+
+char clockText[6] = "--:--";  // written by net, drawn by ui
+portMUX_TYPE clockMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Worst cases since boot, logged when they grow and published with the
+// filter stats
+volatile uint32_t senseLateMaxUs    = 0;  // sense wake-up beyond its deadline
+volatile uint32_t alertLatencyMaxMs = 0;  // sample due -> alarm raised
+uint32_t passLateUs = 0;                  // lateness of the current pass
+
+// CPU time spent in our tasks, for the load figure in the filter stats
+volatile uint32_t taskBusyUs   = 0;
+volatile uint32_t senseWakeups = 0;
+portMUX_TYPE busyMux = portMUX_INITIALIZER_UNLOCKED;  // tasks on both cores add
+esp_pm_lock_handle_t uiPmLock  = nullptr;  // full clock while drawing
+
+// -------------------------------------------------------------
+// Battery Mode
+// -------------------------------------------------------------
+// Opt-in through command/power. Every boot is one timer wake: read the
+// sensors, append a packed sample to RTC slow memory and deep-sleep
+// again, with the TFT and BLE never started. Wi-Fi comes up every
+// batteryEvery samples, or on a new threshold breach, and the whole
+// buffer goes out in one MQTT session. Holding the buzzer button
+// through a wake returns to normal mode. The MQ2 heater is off in this
+// mode, so MQ2 is stored as missing and never counts as a breach. The
+// sample ring and batch encoder are in battery_buffer.h. This edition
+// only: firmware_v3.cpp has no battery mode.
+static const uint32_t RTC_MAGIC = 0x41475242;
+
+RTC_DATA_ATTR uint32_t     rtcMagic;
+RTC_DATA_ATTR SampleRing   rtcRing;
+RTC_DATA_ATTR uint8_t      rtcSinceTry;   // samples since the last upload attempt
+RTC_DATA_ATTR uint8_t      rtcLastFlags;
+RTC_DATA_ATTR uint32_t     rtcUploadFails;
+RTC_DATA_ATTR uint32_t     rtcSampleMs;   // awake time of a sample-only wake
+RTC_DATA_ATTR uint32_t     rtcUploadMs;   // awake time of an upload wake
+
+bool batteryCycle = false;  // inside runBatteryCycle()
+
+// Power model, mA. Board figures with the MQ2 heater (~150 mA) and TFT
+// backlight switched off in hardware; either would drain a cell in
+// hours. Per period: sample at PM_SAMPLE_MA, sleep for the rest, plus
+// 1/batteryEvery of an upload. E.g. 300 s, 12 samples, 0.5 s wakes and
+// 5 s uploads: (20 + 45 + 50) mAs / 300 s = 0.38 mA, ~7 months on 2 Ah.
+static const float    PM_SLEEP_MA    = 0.15f;  // RTC timer, DHT22 standby, regulator
+static const float    PM_SAMPLE_MA   = 40.0f;  // CPU up, radio off, dust LED pulsing
+static const float    PM_UPLOAD_MA   = 120.0f; // Wi-Fi join + MQTT session
+static const float    PM_BATTERY_MAH = 2000.0f;
+static const uint32_t PM_BOOT_MS     = 150;    // ROM + bootloader, before millis() starts
+
 // -------------------------------------------------------------
 // Forward Declarations
 // -------------------------------------------------------------
@@ -211,8 +590,38 @@ void connectMQTT();
 void mqttCallback(char* topic, byte* payload, unsigned int len);
 void publishTelemetry(int temp, int hum, int dust, int mq2);
 void publishThresholds();
-void handleButtons();
-void updateSensorsAndUI();
+void publishFilters();
+void loadFilterConfig();
+void saveFilterConfig();
+bool applyFilterConfig(JsonObject cfg);
+void describeFilters(JsonObject out);
+bool applyGovernorConfig(JsonObject cfg);
+void describeGovernor(JsonObject out);
+void applyGovernorRates();
+void updateGovernor();
+void adoptStagedConfig();
+bool handleButtons();
+void buttonISR();
+void initSensors();
+void serviceSensors();
+bool sensorFresh(SensorId id);
+void updateAlarms();
+void renderUI(const SensorReport& r);
+void updateClock(bool online);
+void publishPending();
+void startTasks();
+void wakeSense();
+void addBusyTime(uint32_t us);
+void startDustBurst();
+void initPowerManagement();
+void checkAlerts(int temp, int hum, int dust, int mq2);
+int alertFlagBits();
+void runBatteryCycle();
+bool uploadBatch(int temp, int hum, int dust, int mq2);
+bool publishBatch(uint32_t now, bool withPower);
+void describePower(JsonObject out);
+bool applyPowerConfig(JsonObject cfg);
+void enterDeepSleep();
 void processLocalAutomation(int temp, int hum, int dust, int mq2);
 void initBLE();
 void handleBLEControl(String cmd);
@@ -292,7 +701,7 @@ class BLEControlCallbacks: public BLECharacteristicCallbacks {
 // BLE Control Handler
 // -------------------------------------------------------------
 void handleBLEControl(String cmd) {
-  StaticJsonDocument<256> doc;
+  StaticJsonDocument<1024> doc;
   DeserializationError err = deserializeJson(doc, cmd);
   
   if (err) {
@@ -311,6 +720,7 @@ void handleBLEControl(String cmd) {
     }
     
     prefs.putBool("buzzer", buzzerEnabled);
+    wakeSense();
     Serial.printf("[BLE] Buzzer => %s\n", buzzerEnabled ? "ON" : "MUTED");
     
     // Send confirmation
@@ -334,6 +744,7 @@ void handleBLEControl(String cmd) {
     if (thresh.containsKey("mq2High")) mq2Threshold = thresh["mq2High"];
     
     savePrefs();
+    wakeSense();
     Serial.println("[BLE] Thresholds updated via BLE");
     
     StaticJsonDocument<128> response;
@@ -344,6 +755,35 @@ void handleBLEControl(String cmd) {
     pControlChar->setValue(jsonResponse.c_str());
     pControlChar->notify();
   }
+
+  // Handle filter pipeline updates: {"filters":{"dust":[{"median":5}]}}
+  if (doc.containsKey("filters")) {
+    bool changed = applyFilterConfig(doc["filters"]);
+    if (changed) saveFilterConfig();
+    Serial.println("[BLE] Filters updated via BLE");
+
+    StaticJsonDocument<128> response;
+    response["success"] = changed;
+    response["message"] = "Filters updated";
+    String jsonResponse;
+    serializeJson(response, jsonResponse);
+    pControlChar->setValue(jsonResponse.c_str());
+    pControlChar->notify();
+    forceThresholdPublish = true;
+  }
+
+  // Handle power mode: {"power":{"battery":true,"periodS":300,"every":12}}
+  if (doc.containsKey("power")) {
+    applyPowerConfig(doc["power"]);
+
+    StaticJsonDocument<128> response;
+    response["success"] = true;
+    response["battery"] = batteryMode;
+    String jsonResponse;
+    serializeJson(response, jsonResponse);
+    pControlChar->setValue(jsonResponse.c_str());
+    pControlChar->notify();
+  }
 }
 
 // -------------------------------------------------------------
@@ -406,9 +846,9 @@ void setup() {
   Serial.begin(115200);
   delay(100);
 
-  esp_wifi_set_ps(WIFI_PS_NONE);
+  initPowerManagement();
   WiFi.setTxPower(WIFI_POWER_19_5dBm);
-  WiFi.setSleep(false);
+  WiFi.setSleep(true);  // modem sleep between DTIM beacons
 
   Serial.println("\n=== Vealive360 SmartMonitor v4 MESH ===");
   Serial.printf("Device ID: %d\n", DEVICE_ID);
@@ -421,22 +861,40 @@ void setup() {
   topicThresholds   = "vealive/smartmonitor/" + devId + "/thresholds";
   topicCmdBuzzer    = "vealive/smartmonitor/" + devId + "/command/buzzer";
   topicCmdThresholds= "vealive/smartmonitor/" + devId + "/command/thresholds";
+  topicFilters      = "vealive/smartmonitor/" + devId + "/filters";
+  topicCmdFilters   = "vealive/smartmonitor/" + devId + "/command/filters";
+  topicBatch        = "vealive/smartmonitor/" + devId + "/batch";
+  topicCmdPower     = "vealive/smartmonitor/" + devId + "/command/power";
 
   uint64_t mac = ESP.getEfuseMac();
   char macTail[9];
   snprintf(macTail, sizeof(macTail), "%08X", (uint32_t)(mac & 0xFFFFFFFF));
   mqttClientId = "SM" + devId + "_" + String(macTail);
 
+  // MQTT setup
+  mqtt.setServer(MQTT_HOST, MQTT_PORT);
+  mqtt.setCallback(mqttCallback);
+  mqtt.setKeepAlive(15);
+  mqtt.setSocketTimeout(5);
+  mqtt.setBufferSize(1024);
+
+  // Battery mode samples and deep-sleeps from here; no TFT or BLE
+  prefs.begin("monitor", false);
+  gpio_deep_sleep_hold_dis();
+  gpio_hold_dis((gpio_num_t)DUSTLEDPIN);
+  if (prefs.getBool("battery", false)) {
+    runBatteryCycle();  // returns only when leaving battery mode
+  }
+
   // Initialize TFT
   tft.init();
   tft.setRotation(1);
   tft.fillScreen(COL_BG);
 
   // Initialize sensors
-  dht.begin();
+  initSensors();
 
   // Initialize IO
-  pinMode(DUSTLEDPIN, OUTPUT);
   pinMode(RED_LED_PIN, OUTPUT);
   pinMode(GREEN_LED_PIN, OUTPUT);
   pinMode(BLUE_LED_PIN, OUTPUT);
@@ -448,25 +906,18 @@ void setup() {
   pinMode(BUZZER_BUTTON_PIN, INPUT_PULLUP);
 
   // Load preferences
-  prefs.begin("monitor", false);
+  loadFilterConfig();
   loadPrefs();
 
   // Initialize BLE (always available)
   initBLE();
 
-  // MQTT setup
-  mqtt.setServer(MQTT_HOST, MQTT_PORT);
-  mqtt.setCallback(mqttCallback);
-  mqtt.setKeepAlive(15);
-  mqtt.setSocketTimeout(5);
-  mqtt.setBufferSize(512);
-
   // Initialize UI immediately (offline-first)
   drawFullUI();
   Serial.println("[UI] Display initialized - device fully operational offline");
 
-  // Attempt WiFi connection in background
-  connectWiFi();
+  // WiFi is brought up by the network task
+  startTasks();
 }
 
 // -------------------------------------------------------------
@@ -551,9 +1002,7 @@ void connectWiFi() {
     unsigned long t0 = millis();
     while (WiFi.status() != WL_CONNECTED && millis() - t0 < 10000) {
       delay(300);
-      digitalWrite(BLUE_LED_PIN, !digitalRead(BLUE_LED_PIN));
     }
-    digitalWrite(BLUE_LED_PIN, LOW);
     
     if (WiFi.status() == WL_CONNECTED) {
       meshMode = false;
@@ -583,9 +1032,7 @@ void connectWiFi() {
   unsigned long t1 = millis();
   while (WiFi.status() != WL_CONNECTED && millis() - t1 < 10000) {
     delay(300);
-    digitalWrite(BLUE_LED_PIN, !digitalRead(BLUE_LED_PIN));
   }
-  digitalWrite(BLUE_LED_PIN, LOW);
   
   if (WiFi.status() == WL_CONNECTED) {
     meshMode = true;
@@ -632,6 +1079,8 @@ void connectMQTT() {
     mqtt.publish(topicStatus.c_str(), "online", true);
     mqtt.subscribe(topicCmdBuzzer.c_str(), 1);
     mqtt.subscribe(topicCmdThresholds.c_str(), 1);
+    mqtt.subscribe(topicCmdFilters.c_str(), 1);
+    mqtt.subscribe(topicCmdPower.c_str(), 1);
 
     forceThresholdPublish = true;
     forceTelemetryPublish = true;
@@ -645,7 +1094,7 @@ void connectMQTT() {
 // MQTT Callback
 // -------------------------------------------------------------
 void mqttCallback(char* topic, byte* payload, unsigned int len) {
-  char msg[256];
+  char msg[1024];  // matches the MQTT buffer; filter configs run long
   size_t copyLen = min((size_t)len, sizeof(msg) - 1);
   memcpy(msg, payload, copyLen);
   msg[copyLen] = '\0';
@@ -667,11 +1116,30 @@ void mqttCallback(char* topic, byte* payload, unsigned int len) {
       }
       
       prefs.putBool("buzzer", buzzerEnabled);
+      wakeSense();
       forceTelemetryPublish = true;
     }
     return;
   }
 
+  if (t == topicCmdPower) {
+    StaticJsonDocument<128> doc;
+    if (deserializeJson(doc, msg)) return;
+    applyPowerConfig(doc.as<JsonObject>());
+    return;
+  }
+
+  if (t == topicCmdFilters) {
+    StaticJsonDocument<1024> doc;
+    if (deserializeJson(doc, msg)) return;
+
+    if (applyFilterConfig(doc.as<JsonObject>())) {
+      saveFilterConfig();
+      forceThresholdPublish = true;
+    }
+    return;
+  }
+
   if (t == topicCmdThresholds) {
     StaticJsonDocument<256> doc;
     DeserializationError err = deserializeJson(doc, msg);
@@ -688,6 +1156,7 @@ void mqttCallback(char* topic, byte* payload, unsigned int len) {
 
     if (changed) {
       savePrefs();
+      wakeSense();
       forceThresholdPublish = true;
       forceTelemetryPublish = true;
     }
@@ -715,23 +1184,50 @@ void publishThresholds() {
   mqtt.publish(topicThresholds.c_str(), buf, true);
 }
 
-void publishTelemetry(int temp, int hum, int dust, int mq2) {
+void publishFilters() {
   if (!mqtt.connected()) return;
 
-  int alertFlags = 0;
-  if (alertTemp) alertFlags |= 1;
-  if (alertHum)  alertFlags |= 2;
-  if (alertDust) alertFlags |= 4;
-  if (alertMq2)  alertFlags |= 8;
+  StaticJsonDocument<1280> doc;
+  describeFilters(doc.createNestedObject("filters"));
+  JsonObject stats = doc.createNestedObject("stats");
+  stats["redraws"]      = cardRedraws;
+  stats["publishes"]    = telemetryPublishes;
+  stats["alertChanges"] = alertTransitions;
+  stats["senseLateMaxUs"]    = senseLateMaxUs;
+  stats["alertLatencyMaxMs"] = alertLatencyMaxMs;
+  stats["uptime"]       = (uint32_t)(millis() / 1000);
+  stats["govSlowness"]  = govSlowness;
+  stats["telemetryMs"]  = telemetryIntervalMs;
+
+  // Load since the previous stats publish (% of one core)
+  static uint32_t lastBusyUs = 0, lastWakeups = 0, lastStatsAt = 0;
+  uint32_t now = millis();
+  uint32_t elapsedMs = now - lastStatsAt;
+  if (lastStatsAt != 0 && elapsedMs > 0) {
+    stats["cpuBusyPct"]    = (taskBusyUs - lastBusyUs) / (elapsedMs * 10.0f);
+    stats["wakeupsPerSec"] = (senseWakeups - lastWakeups) * 1000.0f / elapsedMs;
+  }
+  lastBusyUs = taskBusyUs;
+  lastWakeups = senseWakeups;
+  lastStatsAt = now;
+
+  char buf[1024];
+  serializeJson(doc, buf);
+  mqtt.publish(topicFilters.c_str(), buf, true);
+}
+
+void publishTelemetry(int temp, int hum, int dust, int mq2) {
+  if (!mqtt.connected()) return;
 
   StaticJsonDocument<384> doc;
   doc["id"]         = DEVICE_ID;
-  doc["temp"]       = temp;
-  doc["hum"]        = hum;
-  doc["dust"]       = dust;
-  doc["mq2"]        = mq2;
+  // Missing readings are left out so subscribers keep the last good value
+  if (temp != NO_READING) doc["temp"] = temp;
+  if (hum != NO_READING)  doc["hum"]  = hum;
+  if (dust != NO_READING) doc["dust"] = dust;
+  if (mq2 != NO_READING)  doc["mq2"]  = mq2;
   doc["alert"]      = alertActive ? 1 : 0;
-  doc["alertFlags"] = alertFlags;
+  doc["alertFlags"] = alertFlagBits();
   doc["buzzer"]     = buzzerEnabled ? 1 : 0;
   doc["rssi"]       = WiFi.RSSI();
   doc["uptime"]     = (uint32_t)(millis() / 1000);
@@ -740,7 +1236,7 @@ void publishTelemetry(int temp, int hum, int dust, int mq2) {
 
   char buf[384];
   serializeJson(doc, buf);
-  mqtt.publish(topicTelemetry.c_str(), buf, true);
+  if (mqtt.publish(topicTelemetry.c_str(), buf, true)) telemetryPublishes++;
 }
 
 // -------------------------------------------------------------
@@ -753,6 +1249,9 @@ void processLocalAutomation(int temp, int hum, int dust, int mq2) {
   for (int i = 0; i < 5; i++) {
     if (!localRules[i].enabled) continue;
     
+    int readings[] = {temp, hum, dust, mq2};
+    if (localRules[i].triggerType <= 3 && readings[localRules[i].triggerType] == NO_READING) continue;
+
     bool triggered = false;
     
     switch (localRules[i].triggerType) {
@@ -800,6 +1299,9 @@ bool loadPrefs() {
   mq2Threshold   = prefs.getInt("mq2High", 60);
   buzzerEnabled  = prefs.getBool("buzzer", true);
   timezoneOffset = prefs.getInt("tz", 7200);
+  batteryMode    = prefs.getBool("battery", false);
+  batteryPeriodS = prefs.getUInt("batPeriod", 300);
+  batteryEvery   = prefs.getUChar("batEvery", 12);
 
   return true;  // Always return true - device works without saved WiFi
 }
@@ -815,12 +1317,26 @@ void savePrefs() {
   prefs.putInt("mq2High", mq2Threshold);
   prefs.putBool("buzzer", buzzerEnabled);
   prefs.putInt("tz", timezoneOffset);
+  prefs.putBool("battery", batteryMode);
+  prefs.putUInt("batPeriod", batteryPeriodS);
+  prefs.putUChar("batEvery", batteryEvery);
 }
 
 // -------------------------------------------------------------
 // Handle Buttons
 // -------------------------------------------------------------
-void handleButtons() {
+// Level-triggered so a press also wakes light sleep. Masks itself until
+// the sense task sees both buttons released again.
+void IRAM_ATTR buttonISR() {
+  gpio_intr_disable((gpio_num_t)RESET_BUTTON_PIN);
+  gpio_intr_disable((gpio_num_t)BUZZER_BUTTON_PIN);
+  BaseType_t woken = pdFALSE;
+  xEventGroupSetBitsFromISR(senseEvents, EV_BUTTON, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+// Returns true while a button is down or still settling
+bool handleButtons() {
   static uint32_t resetStart = 0;
   static bool buzzerBtnLast = false;
   static uint32_t buzzerDebounce = 0;
@@ -830,6 +1346,7 @@ void handleButtons() {
     if (resetStart == 0) resetStart = millis();
     if (millis() - resetStart > 2000) {
       Serial.println("[BTN] RESET - clearing prefs");
+      xSemaphoreTake(tftMutex, portMAX_DELAY);
       tft.fillScreen(COL_BG);
       tft.setTextDatum(MC_DATUM);
       tft.setTextColor(COL_TEXT);
@@ -860,44 +1377,618 @@ void handleButtons() {
       forceTelemetryPublish = true;
     }
   }
+
+  return digitalRead(RESET_BUTTON_PIN) == LOW || pressed || pressed != buzzerBtnLast;
 }
 
 // -------------------------------------------------------------
-// Update Sensors and UI
+// Sensor Filters
 // -------------------------------------------------------------
-void updateSensorsAndUI() {
-  float tf = dht.readTemperature();
-  float hf = dht.readHumidity();
-  
-  if (isnan(tf) || isnan(hf)) {
+static int32_t medianStage(FilterStage& st, int32_t x) {
+  uint8_t n = st.param;
+  st.hist[st.pos] = x;
+  st.pos = (st.pos + 1) % n;
+  if (st.count < n) st.count++;
+
+  int32_t sorted[MEDIAN_MAX_N];
+  for (uint8_t i = 0; i < st.count; i++) {
+    int32_t v = st.hist[i];
+    int j = i - 1;
+    while (j >= 0 && sorted[j] > v) { sorted[j + 1] = sorted[j]; j--; }
+    sorted[j + 1] = v;
+  }
+  return sorted[(st.count - 1) / 2];  // lower median while filling
+}
+
+static int32_t runStage(FilterStage& st, int32_t x) {
+  if (st.kind == FILTER_MEDIAN) return medianStage(st, x);
+  if (!st.primed) {
+    st.primed = true;
+    st.last = x;
+    return x;
+  }
+
+  int32_t delta = x - st.last;
+  switch (st.kind) {
+    case FILTER_EMA:
+      st.last += delta * st.param / FIX_ONE;
+      break;
+    case FILTER_SLEW:
+      st.last += delta > st.param ? st.param : (delta < -st.param ? -st.param : delta);
+      break;
+    case FILTER_SPIKE:
+      // Hold the previous value for one sample on a jump; a jump that
+      // is still there on the next sample is a real step
+      if (abs(delta) > st.param && st.count == 0) {
+        st.count = 1;
+        break;
+      }
+      st.count = 0;
+      st.last = x;
+      break;
+    default:
+      break;
+  }
+  return st.last;
+}
+
+int32_t filterFixed(FilterChannel ch, int32_t x) {
+  FilterChain& chain = filters[ch];
+  for (uint8_t i = 0; i < chain.stageCount; i++) {
+    x = runStage(chain.stages[i], x);
+  }
+  return x;
+}
+
+float filterSample(FilterChannel ch, float value) {
+  return (float)filterFixed(ch, (int32_t)lroundf(value * FIX_ONE)) / FIX_ONE;
+}
+
+// {"dust":[{"median":5},{"ema":0.3}],"temp":[{"spike":3}]}
+// Channels not mentioned keep their chain; an empty array clears one.
+// Replacing a chain also resets its state. A "governor" object is
+// handed to applyGovernorConfig().
+bool applyFilterConfig(JsonObject cfg) {
+  bool changed = false;
+  for (uint8_t c = 0; c < CH_COUNT; c++) {
+    if (!cfg.containsKey(filters[c].name)) continue;
+
+    FilterChain next = {filters[c].name};
+    for (JsonObject st : cfg[filters[c].name].as<JsonArray>()) {
+      if (next.stageCount == FILTER_MAX_STAGES) break;
+      for (uint8_t k = 0; k < FILTER_KIND_COUNT; k++) {
+        if (!st.containsKey(FILTER_KIND_NAMES[k])) continue;
+        FilterStage& stage = next.stages[next.stageCount++];
+        stage.kind = (FilterKind)k;
+        if (k == FILTER_MEDIAN) {
+          stage.param = constrain(st[FILTER_KIND_NAMES[k]].as<int>(), 1, (int)MEDIAN_MAX_N);
+        } else {
+          stage.param = max(1L, lroundf(st[FILTER_KIND_NAMES[k]].as<float>() * FIX_ONE));
+          if (k == FILTER_EMA) stage.param = min(stage.param, FIX_ONE);
+        }
+        break;
+      }
+    }
+    portENTER_CRITICAL(&configMux);
+    stagedFilters[c] = next;
+    stagedFilterMask |= 1 << c;
+    portEXIT_CRITICAL(&configMux);
+    changed = true;
+  }
+
+  if (cfg.containsKey("governor")) {
+    changed |= applyGovernorConfig(cfg["governor"]);
+  }
+  if (changed) wakeSense();
+  return changed;
+}
+
+// Reports the config as last set, staged or not; only stage kinds and
+// params are read, and those change under configMux alone
+void describeFilters(JsonObject out) {
+  for (uint8_t c = 0; c < CH_COUNT; c++) {
+    FilterChain chain;
+    portENTER_CRITICAL(&configMux);
+    chain = (stagedFilterMask & (1 << c)) ? stagedFilters[c] : filters[c];
+    portEXIT_CRITICAL(&configMux);
+
+    JsonArray stages = out.createNestedArray(chain.name);
+    for (uint8_t i = 0; i < chain.stageCount; i++) {
+      const FilterStage& stage = chain.stages[i];
+      JsonObject o = stages.createNestedObject();
+      if (stage.kind == FILTER_MEDIAN) {
+        o[FILTER_KIND_NAMES[stage.kind]] = stage.param;
+      } else {
+        o[FILTER_KIND_NAMES[stage.kind]] = (float)stage.param / FIX_ONE;
+      }
+    }
+  }
+  describeGovernor(out.createNestedObject("governor"));
+}
+
+void loadFilterConfig() {
+  StaticJsonDocument<1024> doc;
+  String saved = prefs.getString("filters", DEFAULT_FILTERS);
+  if (deserializeJson(doc, saved)) {
+    deserializeJson(doc, DEFAULT_FILTERS);
+  }
+  applyFilterConfig(doc.as<JsonObject>());
+  adoptStagedConfig();  // before the sense task runs
+}
+
+void saveFilterConfig() {
+  StaticJsonDocument<1024> doc;
+  describeFilters(doc.to<JsonObject>());
+  String json;
+  serializeJson(doc, json);
+  prefs.putString("filters", json);
+}
+
+// Sense task, before every pass
+void adoptStagedConfig() {
+  if (!stagedFilterMask && !governorStaged) return;
+
+  bool rates = false;
+  portENTER_CRITICAL(&configMux);
+  for (uint8_t c = 0; c < CH_COUNT; c++) {
+    if (stagedFilterMask & (1 << c)) filters[c] = stagedFilters[c];
+  }
+  stagedFilterMask = 0;
+  if (governorStaged) {
+    governor = stagedGovernor;
+    governorStaged = false;
+    rates = true;
+  }
+  portEXIT_CRITICAL(&configMux);
+
+  if (rates) applyGovernorRates();
+}
+
+// -------------------------------------------------------------
+// Sampling Governor
+// -------------------------------------------------------------
+// The governor config as last set, staged or not (net task side)
+static GovernorConfig governorView() {
+  portENTER_CRITICAL(&configMux);
+  GovernorConfig g = governorStaged ? stagedGovernor : governor;
+  portEXIT_CRITICAL(&configMux);
+  return g;
+}
+
+static void readBounds(JsonArray in, RateBounds& b, uint32_t floorMs, uint32_t ceilMs = UINT32_MAX) {
+  b.fastMs = min(ceilMs, max(floorMs, in[0].as<uint32_t>()));
+  b.slowMs = min(ceilMs, max(b.fastMs, in[1].as<uint32_t>()));
+}
+
+// {"dht":[2000,10000],"telemetry":[2000,15000],"trigger":{"temp":1},
+//  "holdMs":30000,"rampMs":60000}
+// Bounds are [fast, slow] in ms; a sensor cannot go below its native
+// period, and telemetry cannot go above TELEMETRY_SLOW_MAX_MS. Keys not
+// mentioned keep their value. Staged like the filters; the sense task
+// applies the new rates when it adopts it.
+bool applyGovernorConfig(JsonObject cfg) {
+  if (cfg.isNull()) return false;
+
+  GovernorConfig next = governorView();
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    if (cfg.containsKey(schedules[i].name)) {
+      readBounds(cfg[schedules[i].name], next.sensors[i], schedules[i].periodMs);
+    }
+  }
+  if (cfg.containsKey("telemetry")) {
+    readBounds(cfg["telemetry"], next.telemetry, 1000, TELEMETRY_SLOW_MAX_MS);
+  }
+
+  JsonObject trigger = cfg["trigger"];
+  for (uint8_t c = 0; c < CH_COUNT; c++) {
+    if (trigger.containsKey(filters[c].name)) {
+      next.trigger[c] = max(0.0f, trigger[filters[c].name].as<float>());
+    }
+  }
+
+  if (cfg.containsKey("holdMs")) next.holdMs = cfg["holdMs"];
+  if (cfg.containsKey("rampMs")) next.rampMs = max((uint32_t)1000, cfg["rampMs"].as<uint32_t>());
+
+  portENTER_CRITICAL(&configMux);
+  stagedGovernor = next;
+  governorStaged = true;
+  portEXIT_CRITICAL(&configMux);
+  return true;
+}
+
+void describeGovernor(JsonObject out) {
+  GovernorConfig g = governorView();
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    JsonArray b = out.createNestedArray(schedules[i].name);
+    b.add(g.sensors[i].fastMs);
+    b.add(g.sensors[i].slowMs);
+  }
+  JsonArray t = out.createNestedArray("telemetry");
+  t.add(g.telemetry.fastMs);
+  t.add(g.telemetry.slowMs);
+
+  JsonObject trigger = out.createNestedObject("trigger");
+  for (uint8_t c = 0; c < CH_COUNT; c++) {
+    trigger[filters[c].name] = g.trigger[c];
+  }
+  out["holdMs"] = g.holdMs;
+  out["rampMs"] = g.rampMs;
+}
+
+static uint32_t lerpBounds(const RateBounds& b) {
+  return b.fastMs + (uint32_t)((b.slowMs - b.fastMs) * govSlowness);
+}
+
+void applyGovernorRates() {
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    SensorSchedule& sched = schedules[i];
+    sched.activeMs = lerpBounds(governor.sensors[i]);
+    // Speeding up must not wait out the rest of a slow period
+    if ((int32_t)(sched.nextDue - (now + sched.activeMs)) > 0) {
+      sched.nextDue = now + sched.activeMs;
+    }
+  }
+  telemetryIntervalMs = lerpBounds(governor.telemetry);
+}
+
+// Sense task, after every pass. Slopes are measured against a reference
+// at least GOV_WINDOW_MS old, so sensor noise at the fast rate does not
+// read as an event but a step shows up on the very next sample.
+void updateGovernor() {
+  static const SensorId CH_SENSOR[CH_COUNT] = {SENSOR_DHT, SENSOR_DHT, SENSOR_DUST, SENSOR_MQ2};
+  static float    refValue[CH_COUNT] = {NAN, NAN, NAN, NAN};
+  static uint32_t refAt[CH_COUNT]    = {0};
+  static uint32_t lastAt[CH_COUNT]   = {0};
+  static uint32_t lastRun = 0;
+  const float value[CH_COUNT] = {snapshot.temp, snapshot.hum, snapshot.dust, snapshot.mq2};
+
+  uint32_t now = millis();
+  bool event = alertActive;
+
+  for (uint8_t c = 0; c < CH_COUNT; c++) {
+    uint32_t at = schedules[CH_SENSOR[c]].sampledAt;
+    if (at == 0 || at == lastAt[c] || isnan(value[c])) continue;
+    lastAt[c] = at;
+
+    if (isnan(refValue[c])) {
+      refValue[c] = value[c];
+      refAt[c] = at;
+      continue;
+    }
+    uint32_t span = at - refAt[c];
+    float perMin = fabsf(value[c] - refValue[c]) * 60000.0f / max(span, GOV_WINDOW_MS);
+    if (perMin > governor.trigger[c]) event = true;
+    if (span >= GOV_WINDOW_MS) {
+      refValue[c] = value[c];
+      refAt[c] = at;
+    }
+  }
+
+  if (event) {
+    if (govSlowness > 0) Serial.println("[GOV] Event, fast rates");
+    govEventAt = now;
+    govSlowness = 0;
+  } else if (now - govEventAt > governor.holdMs && govSlowness < 1) {
+    govSlowness = min(1.0f, govSlowness + (float)(now - lastRun) / governor.rampMs);
+  }
+  lastRun = now;
+
+  applyGovernorRates();
+}
+
+// -------------------------------------------------------------
+// Sensor Acquisition
+// -------------------------------------------------------------
+void IRAM_ATTR dhtEdgeISR() {
+  if (dhtPhase != DHT_CAPTURE) return;
+  uint8_t n = dhtEdgeCount;
+  if (n < DHT_MAX_EDGES) {
+    dhtEdges[n] = (uint32_t)esp_timer_get_time();
+    dhtEdgeCount = n + 1;
+  }
+}
+
+// esp_timer callback: end of the host start pulse, hand the bus to the sensor
+void dhtReleaseBus(void*) {
+  dhtEdgeCount = 0;
+  dhtPhase = DHT_CAPTURE;
+  digitalWrite(DHTPIN, HIGH);
+}
+
+// Timer alarm: each phase sets the delay to the next one
+void IRAM_ATTR dustTimerISR() {
+  BaseType_t woken = pdFALSE;
+  switch (dustPhase) {
+    case DUST_PULSE_START:
+      digitalWrite(DUSTLEDPIN, LOW);
+      dustLedOnAt = (uint32_t)esp_timer_get_time();
+      dustPhase = DUST_SAMPLE;
+      timerAlarmWrite(dustHwTimer, DUST_SAMPLE_US, true);
+      break;
+    case DUST_SAMPLE:
+      xTaskNotifyFromISR(dustTaskHandle, ADC_NOTIFY_DUST, eSetBits, &woken);
+      dustPhase = DUST_PULSE_END;
+      timerAlarmWrite(dustHwTimer, DUST_LED_OFF_US, true);
+      break;
+    case DUST_PULSE_END:
+      digitalWrite(DUSTLEDPIN, HIGH);
+      dustPhase = DUST_PULSE_START;
+      if (--dustBurstLeft == 0) {
+        timerAlarmDisable(dustHwTimer);
+        esp_pm_lock_release(sensorPmLock);
+        break;
+      }
+      timerAlarmWrite(dustHwTimer, DUST_PERIOD_US - DUST_SAMPLE_US - DUST_LED_OFF_US, true);
+      break;
+  }
+  if (woken) portYIELD_FROM_ISR();
+}
+
+static uint16_t medianOf(uint16_t* v, uint8_t n) {
+  for (uint8_t i = 1; i < n; i++) {
+    uint16_t x = v[i];
+    int j = i - 1;
+    while (j >= 0 && v[j] > x) { v[j + 1] = v[j]; j--; }
+    v[j + 1] = x;
+  }
+  return v[n / 2];
+}
+
+// esp_timer callback: one MQ2 tick, converted by the ADC task
+void mq2Tick(void*) {
+  xTaskNotify(dustTaskHandle, ADC_NOTIFY_MQ2, eSetBits);
+}
+
+static void sampleMq2() {
+  if (!mq2BurstLeft) return;  // tick that raced the end of the burst
+  for (uint8_t i = 0; i < MQ2_SAMPLES_PER_TICK; i++) {
+    uint16_t raw = analogRead(MQ2PIN);
+    mq2BoxSum = mq2BoxSum - mq2Ring[mq2RingPos] + raw;
+    mq2Ring[mq2RingPos] = raw;
+    if (++mq2RingPos == MQ2_BOX_LEN) mq2RingPos = 0;
+  }
+  if (--mq2BurstLeft == 0) {
+    esp_timer_stop(mq2Timer);
+    mq2BurstDoneAt = millis();
+    esp_pm_lock_release(sensorPmLock);
+  }
+}
+
+// Every DUST_MEDIAN_K pulses the median goes into the window, so single
+// spikes never reach it
+static void convertDustPulse() {
+  static uint16_t group[DUST_MEDIAN_K];
+  static uint8_t groupLen = 0;
+
+  int raw = analogRead(DUSTPIN);
+  uint32_t doneAt = (uint32_t)esp_timer_get_time() - dustLedOnAt;
+  dustPulses++;
+  if (doneAt > DUST_SAMPLE_US + DUST_LED_OFF_US) {
+    dustLate++;
     return;
   }
 
-  // Dust sensor
-  digitalWrite(DUSTLEDPIN, LOW);
-  delayMicroseconds(280);
-  int dustRaw = analogRead(DUSTPIN);
-  delayMicroseconds(40);
-  digitalWrite(DUSTLEDPIN, HIGH);
-  delayMicroseconds(9680);
-  
-  float dustV = dustRaw * (3.3f / 4095.0f);
-  float dustF = fabs((dustV - 0.6f) * 200.0f);
-
-  float mq2V = analogRead(MQ2PIN) * (3.3f / 4095.0f);
-  float mq2F = mq2V * 1000.0f;
-
-  int temp = (int)roundf(tf);
-  int hum  = (int)roundf(hf);
-  int dust = (int)roundf(dustF);
-  int mq2  = (int)roundf(mq2F);
-
-  // Check alerts
-  alertTemp = (temp < tempMin || temp > tempMax);
-  alertHum  = (hum < humMin || hum > humMax);
-  alertDust = (dust > dustThreshold);
-  alertMq2  = (mq2 > mq2Threshold);
+  group[groupLen++] = raw;
+  if (groupLen < DUST_MEDIAN_K) return;
+  groupLen = 0;
+
+  uint16_t median = medianOf(group, DUST_MEDIAN_K);
+  portENTER_CRITICAL(&dustMux);
+  dustWindowSum += median;
+  dustWindowCount++;
+  portEXIT_CRITICAL(&dustMux);
+}
+
+// Converts dust pulses and MQ2 ticks as their timers notify. An MQ2 tick
+// waits while the LED is on so it cannot push the dust conversion past
+// LED off.
+void adcSamplerTask(void*) {
+  bool mq2Pending = false;
+
+  for (;;) {
+    uint32_t bits = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+    if (bits & ADC_NOTIFY_DUST) convertDustPulse();
+    if (bits & ADC_NOTIFY_MQ2) mq2Pending = true;
+    if (mq2Pending && dustPhase != DUST_SAMPLE) {
+      mq2Pending = false;
+      sampleMq2();
+    }
+  }
+}
+
+void initSensors() {
+  // Open-drain with pull-up: the data line is never switched between
+  // input and output, and the edge interrupt stays attached throughout
+  pinMode(DHTPIN, OUTPUT_OPEN_DRAIN | PULLUP);
+  digitalWrite(DHTPIN, HIGH);
+  attachInterrupt(digitalPinToInterrupt(DHTPIN), dhtEdgeISR, FALLING);
+
+  pinMode(DUSTLEDPIN, OUTPUT);
+  digitalWrite(DUSTLEDPIN, HIGH);  // LED is active low
+
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "sensors", &sensorPmLock);
+
+  esp_timer_create_args_t args = {};
+  args.callback = dhtReleaseBus;
+  args.name = "dht";
+  esp_timer_create(&args, &dhtTimer);
+  args.callback = mq2Tick;
+  args.name = "mq2";
+  esp_timer_create(&args, &mq2Timer);
+
+  esp_adc_cal_value_t cal = esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &adcChars);
+  Serial.printf("[SENS] ADC calibration: %s\n",
+                cal == ESP_ADC_CAL_VAL_EFUSE_TP ? "eFuse two-point" :
+                cal == ESP_ADC_CAL_VAL_EFUSE_VREF ? "eFuse Vref" : "default Vref");
+
+  // Timer 0 at 1 us ticks (IRrecv claims timer 3)
+  xTaskCreatePinnedToCore(adcSamplerTask, "adc", 2048, nullptr,
+                          configMAX_PRIORITIES - 1, &dustTaskHandle, ARDUINO_RUNNING_CORE);
+  dustHwTimer = timerBegin(0, 80, true);
+  timerAttachInterrupt(dustHwTimer, dustTimerISR, true);
+  startDustBurst();
+}
+
+void startDustBurst() {
+  if (dustBurstLeft) return;  // previous burst still running
+
+  esp_pm_lock_acquire(sensorPmLock);
+  dustBurstLeft = DUST_BURST_PULSES;
+  timerWrite(dustHwTimer, 0);
+  timerAlarmWrite(dustHwTimer, 100, true);  // first pulse right away
+  timerAlarmEnable(dustHwTimer);
+}
+
+void startMq2Burst() {
+  if (mq2BurstLeft) return;  // previous burst still running
+
+  esp_pm_lock_acquire(sensorPmLock);
+  mq2BurstLeft = MQ2_BURST_TICKS;
+  esp_timer_start_periodic(mq2Timer, MQ2_TICK_US);
+}
+
+void startDhtRead() {
+  esp_pm_lock_acquire(sensorPmLock);
+  dhtPhase = DHT_START;
+  dhtStartedAt = millis();
+  digitalWrite(DHTPIN, LOW);
+  esp_timer_start_once(dhtTimer, DHT_START_LOW_US);
+}
+
+// Each data bit is a 50 us low followed by a 26 us (0) or 70 us (1) high,
+// so the period between falling edges gives the bit. The last 41 edges
+// bound the 40 bits whether or not the ack edge was caught.
+bool decodeDhtFrame(float& temp, float& hum) {
+  uint8_t n = dhtEdgeCount;
+  if (n < 41) return false;
+
+  uint8_t data[5] = {0, 0, 0, 0, 0};
+  const volatile uint32_t* e = dhtEdges + (n - 41);
+  for (int i = 0; i < 40; i++) {
+    uint32_t period = e[i + 1] - e[i];
+    if (period < 60 || period > 160) return false;
+    data[i / 8] = (data[i / 8] << 1) | (period > 100 ? 1 : 0);
+  }
+  if ((uint8_t)(data[0] + data[1] + data[2] + data[3]) != data[4]) return false;
+
+  hum  = ((data[0] << 8) | data[1]) * 0.1f;
+  temp = (((data[2] & 0x7F) << 8) | data[3]) * 0.1f;
+  if (data[2] & 0x80) temp = -temp;
+  return true;
+}
+
+// Dust: mean of the window's group medians
+void harvestDust(uint32_t now) {
+  portENTER_CRITICAL(&dustMux);
+  uint32_t dustSum = dustWindowSum;
+  uint16_t dustCount = dustWindowCount;
+  dustWindowSum = 0;
+  dustWindowCount = 0;
+  portEXIT_CRITICAL(&dustMux);
+
+  if (dustCount == 0) {
+    schedules[SENSOR_DUST].failures++;
+    return;
+  }
+  uint32_t mv = esp_adc_cal_raw_to_voltage((dustSum + dustCount / 2) / dustCount, &adcChars);
+  snapshot.dust = (float)filterFixed(CH_DUST, lookupQ8(DUST_TABLE, mv)) / FIX_ONE;
+  schedules[SENSOR_DUST].sampledAt = now;
+}
+
+// MQ2: boxcar mean of the last burst, calibrated to millivolts, then
+// ppm. Nothing new until another burst has finished.
+void harvestMq2() {
+  uint32_t doneAt = mq2BurstDoneAt;
+  if (doneAt == 0 || doneAt == schedules[SENSOR_MQ2].sampledAt) return;
+  uint32_t raw = (mq2BoxSum + MQ2_BOX_LEN / 2) / MQ2_BOX_LEN;
+  uint32_t mv = esp_adc_cal_raw_to_voltage(raw, &adcChars);
+  snapshot.mq2 = (float)filterFixed(CH_MQ2, lookupQ8(MQ2_TABLE, mv)) / FIX_ONE;
+  schedules[SENSOR_MQ2].sampledAt = doneAt;
+}
+
+void runSensor(SensorId id, uint32_t now) {
+  switch (id) {
+    case SENSOR_DHT:
+      if (dhtPhase == DHT_IDLE) startDhtRead();  // result collected in serviceSensors()
+      break;
+    case SENSOR_DUST:
+      harvestDust(now);
+      startDustBurst();
+      break;
+    case SENSOR_MQ2:
+      harvestMq2();
+      startMq2Burst();
+      break;
+    default:
+      break;
+  }
+}
+
+// Called every sense wake-up. Collects finished conversions into the
+// snapshot and starts whichever sensors are due; never waits on one.
+void serviceSensors() {
+  uint32_t now = millis();
+
+  if (dhtPhase == DHT_CAPTURE && now - dhtStartedAt >= schedules[SENSOR_DHT].latencyMs) {
+    dhtPhase = DHT_IDLE;
+    esp_pm_lock_release(sensorPmLock);
+    float t, h;
+    if (decodeDhtFrame(t, h)) {
+      snapshot.temp = filterSample(CH_TEMP, t);
+      snapshot.hum = filterSample(CH_HUM, h);
+      schedules[SENSOR_DHT].sampledAt = now;
+    } else {
+      schedules[SENSOR_DHT].failures++;
+    }
+  }
+
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    SensorSchedule& sched = schedules[i];
+    if ((int32_t)(now - sched.nextDue) < 0) continue;
+    sched.nextDue = now + sched.activeMs;
+    runSensor((SensorId)i, now);
+  }
+}
+
+bool sensorFresh(SensorId id) {
+  const SensorSchedule& sched = schedules[id];
+  return sched.sampledAt != 0 && millis() - sched.sampledAt <= max(sched.maxAgeMs, 2 * sched.activeMs);
+}
+
+// -------------------------------------------------------------
+// Alarms
+// -------------------------------------------------------------
+// Per-stat, only for sensors with a current reading
+void checkAlerts(int temp, int hum, int dust, int mq2) {
+  alertTemp = temp != NO_READING && (temp < tempMin || temp > tempMax);
+  alertHum  = hum != NO_READING && (hum < humMin || hum > humMax);
+  alertDust = dust != NO_READING && dust > dustThreshold;
+  alertMq2  = mq2 != NO_READING && mq2 > mq2Threshold;
   alertActive = alertTemp || alertHum || alertDust || alertMq2;
+}
+
+int alertFlagBits() {
+  int flags = 0;
+  if (alertTemp) flags |= 1;
+  if (alertHum)  flags |= 2;
+  if (alertDust) flags |= 4;
+  if (alertMq2)  flags |= 8;
+  return flags;
+}
+
+// Runs every sense pass: alert state, buzzer and LEDs straight from the
+// snapshot, then hands a report to the UI and network tasks on change.
+void updateAlarms() {
+  // Latest samples; a missing or stale sensor only blanks its own card
+  bool dhtOk = sensorFresh(SENSOR_DHT);
+  int temp = dhtOk ? (int)roundf(snapshot.temp) : NO_READING;
+  int hum  = dhtOk ? (int)roundf(snapshot.hum) : NO_READING;
+  int dust = sensorFresh(SENSOR_DUST) ? (int)roundf(snapshot.dust) : NO_READING;
+  int mq2  = sensorFresh(SENSOR_MQ2) ? (int)roundf(snapshot.mq2) : NO_READING;
+
+  checkAlerts(temp, hum, dust, mq2);
 
   // Process local automation
   processLocalAutomation(temp, hum, dust, mq2);
@@ -914,6 +2005,28 @@ void updateSensorsAndUI() {
     beepState = false;
   }
 
+  // Latency of an alert raised by a sample that arrived since the last
+  // pass (threshold edits don't count), including a late wake-up
+  static int lastAlertBits = 0;
+  static uint32_t lastPassAt = 0;
+  uint32_t now = millis();
+  int alertBits = (alertTemp ? 1 : 0) | (alertHum ? 2 : 0) | (alertDust ? 4 : 0) | (alertMq2 ? 8 : 0);
+  int raised = alertBits & ~lastAlertBits;
+  if (raised) {
+    SensorId src = (raised & 3) ? SENSOR_DHT : (raised & 4) ? SENSOR_DUST : SENSOR_MQ2;
+    uint32_t sampledAt = schedules[src].sampledAt;
+    uint32_t latency = now - sampledAt + passLateUs / 1000;
+    if ((int32_t)(sampledAt - lastPassAt) > 0 && latency > alertLatencyMaxMs) {
+      alertLatencyMaxMs = latency;
+      Serial.printf("[SENSE] Worst alert latency: %u ms (%s)\n", alertLatencyMaxMs, schedules[src].name);
+    }
+  }
+  if (alertBits != lastAlertBits) {
+    alertTransitions++;
+    lastAlertBits = alertBits;
+  }
+  lastPassAt = now;
+
   // LED status
   if (alertActive) {
     setLED("ALERT");
@@ -925,14 +2038,41 @@ void updateSensorsAndUI() {
     setLED("OFFLINE");
   }
 
+  static SensorReport last = {INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, false, false};
+  SensorReport report = {temp, hum, dust, mq2, alertActive, !buzzerEnabled};
+  if (report.temp != last.temp || report.hum != last.hum || report.dust != last.dust ||
+      report.mq2 != last.mq2 || report.alert != last.alert || report.muted != last.muted) {
+    xQueueOverwrite(uiReports, &report);
+    xQueueOverwrite(netReports, &report);
+    last = report;
+  }
+}
+
+// Caller holds tftMutex
+void renderUI(const SensorReport& r) {
   if (!uiInitialized) {
     drawFullUI();
     uiInitialized = true;
   }
 
-  // Get time string
+  char timeStr[6];
+  portENTER_CRITICAL(&clockMux);
+  memcpy(timeStr, clockText, sizeof(timeStr));
+  portEXIT_CRITICAL(&clockMux);
+
+  drawHeader(String(timeStr), r.alert);
+  drawCards(r.temp, r.hum, r.dust, r.mq2);
+  drawFooter();
+
+  if (r.muted != lastMuteState) {
+    drawMuteIcon(r.muted);
+    lastMuteState = r.muted;
+  }
+}
+
+void updateClock(bool online) {
   String timeStr = "--:--";
-  if (WiFi.status() == WL_CONNECTED && internetAvailable) {
+  if (online) {
     timeClient.update();
     String formatted = timeClient.getFormattedTime();
     if (formatted.length() >= 5) {
@@ -940,59 +2080,406 @@ void updateSensorsAndUI() {
     }
   }
 
-  drawHeader(timeStr, alertActive);
-  drawCards(temp, hum, dust, mq2);
-  drawFooter();
+  portENTER_CRITICAL(&clockMux);
+  strlcpy(clockText, timeStr.c_str(), sizeof(clockText));
+  portEXIT_CRITICAL(&clockMux);
+}
+
+// Network task: telemetry from the latest report, thresholds on their timer
+void publishPending() {
+  SensorReport r;
+  if (!mqtt.connected() || xQueuePeek(netReports, &r, 0) != pdTRUE) return;
+
+  if (forceTelemetryPublish || millis() - lastTelemetry >= telemetryIntervalMs) {
+    publishTelemetry(r.temp, r.hum, r.dust, r.mq2);
+    lastTelemetry = millis();
+    forceTelemetryPublish = false;
+  }
+
+  if (forceThresholdPublish || millis() - lastThresholdPub >= THRESHOLD_INTERVAL_MS) {
+    publishThresholds();
+    publishFilters();
+    lastThresholdPub = millis();
+    forceThresholdPublish = false;
+  }
+}
 
-  bool muted = !buzzerEnabled;
-  if (muted != lastMuteState) {
-    drawMuteIcon(muted);
-    lastMuteState = muted;
+// -------------------------------------------------------------
+// Power Management
+// -------------------------------------------------------------
+// Scales the CPU down when idle and light-sleeps when every task is
+// blocked. 80 MHz minimum keeps APB, and so the sensor timer, steady.
+// Builds without tickless idle fall back to frequency scaling only.
+void initPowerManagement() {
+  esp_pm_config_esp32_t pm = {};
+  pm.max_freq_mhz = 240;
+  pm.min_freq_mhz = 80;
+  pm.light_sleep_enable = true;
+
+  esp_err_t err = esp_pm_configure(&pm);
+  if (err == ESP_ERR_NOT_SUPPORTED) {
+    pm.light_sleep_enable = false;
+    err = esp_pm_configure(&pm);
   }
 
-  // MQTT publishing (only if connected)
-  if (mqtt.connected()) {
-    if (forceTelemetryPublish || millis() - lastTelemetry >= TELEMETRY_INTERVAL_MS) {
-      publishTelemetry(temp, hum, dust, mq2);
-      lastTelemetry = millis();
-      forceTelemetryPublish = false;
+  if (err != ESP_OK) {
+    Serial.printf("[PM] Not available: %s\n", esp_err_to_name(err));
+  } else {
+    Serial.printf("[PM] DFS %d-%d MHz, light sleep %s\n",
+                  pm.min_freq_mhz, pm.max_freq_mhz, pm.light_sleep_enable ? "on" : "off");
+  }
+}
+
+// -------------------------------------------------------------
+// Battery Mode
+// -------------------------------------------------------------
+void runBatteryCycle() {
+  batteryCycle = true;
+  bool coldStart = esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER || rtcMagic != RTC_MAGIC;
+  if (coldStart) {
+    rtcRing.clear();
+    rtcSinceTry = rtcLastFlags = 0;
+    rtcUploadFails = rtcSampleMs = rtcUploadMs = 0;
+    rtcMagic = RTC_MAGIC;
+  }
+
+  pinMode(BUZZER_BUTTON_PIN, INPUT_PULLUP);
+  delay(5);
+  if (digitalRead(BUZZER_BUTTON_PIN) == LOW) {
+    Serial.println("[BATT] Button held - back to normal mode");
+    prefs.putBool("battery", false);
+    batteryCycle = false;
+    return;
+  }
+
+  loadFilterConfig();
+  loadPrefs();
+  initSensors();  // starts the first dust burst
+
+  // DHT frame while the dust burst runs
+  startDhtRead();
+  delay(schedules[SENSOR_DHT].latencyMs + 2);
+  dhtPhase = DHT_IDLE;
+  esp_pm_lock_release(sensorPmLock);
+  float t = NAN, h = NAN;
+  bool dhtOk = decodeDhtFrame(t, h);
+
+  while (dustBurstLeft) delay(5);
+  delay(1);  // last conversion in the sampler task
+
+  harvestDust(millis());
+  bool dustOk = schedules[SENSOR_DUST].sampledAt != 0;
+
+  // No MQ2: the heater is off
+  int temp = dhtOk ? (int)roundf(t) : NO_READING;
+  int hum  = dhtOk ? (int)roundf(h) : NO_READING;
+  int dust = dustOk ? (int)roundf(snapshot.dust) : NO_READING;
+  int mq2  = NO_READING;
+  checkAlerts(temp, hum, dust, mq2);
+
+  SampleReading reading = {
+    dhtOk ? t : NAN, dhtOk ? h : NAN, dustOk ? dust : -1, -1, (uint8_t)alertFlagBits()
+  };
+  PackedSample s = packSample((uint32_t)time(nullptr), reading);
+  rtcRing.push(s);
+  rtcSinceTry++;
+
+  // Only alert bits that were clear last time count as a breach
+  bool breach = (s.flags & ~rtcLastFlags) != 0;
+  rtcLastFlags = s.flags;
+  Serial.printf("[BATT] Sample %u buffered (%u/%u)%s\n",
+                rtcRing.count, rtcSinceTry, batteryEvery, breach ? " - breach" : "");
+
+  if (rtcSinceTry >= batteryEvery || breach) {
+    rtcSinceTry = 0;
+    if (uploadBatch(temp, hum, dust, mq2)) {
+      rtcUploadMs = millis() + PM_BOOT_MS;
+    } else {
+      rtcUploadFails++;
+    }
+  } else {
+    rtcSampleMs = millis() + PM_BOOT_MS;
+  }
+
+  // Switched off by a retained command during the upload
+  if (!batteryMode) {
+    Serial.println("[BATT] Battery mode off - restarting");
+    ESP.restart();
+  }
+  enterDeepSleep();
+}
+
+// One MQTT session: retained commands first, then the buffer oldest
+// first, then the latest sample as ordinary telemetry
+bool uploadBatch(int temp, int hum, int dust, int mq2) {
+  lastWifiAttempt = millis() - WIFI_RETRY_INTERVAL_MS;  // no retry gate on a fresh boot
+  connectWiFi();
+  if (WiFi.status() == WL_CONNECTED && !mqtt.connected()) {
+    lastMqttAttempt = millis() - 3000;
+    connectMQTT();
+  }
+
+  bool ok = mqtt.connected();
+  if (ok) {
+    for (int i = 0; i < 10; i++) {
+      mqtt.loop();
+      delay(20);
     }
 
-    if (forceThresholdPublish || millis() - lastThresholdPub >= THRESHOLD_INTERVAL_MS) {
-      publishThresholds();
-      lastThresholdPub = millis();
-      forceThresholdPublish = false;
+    uint32_t now = (uint32_t)time(nullptr);
+    bool first = true;
+    while (ok && rtcRing.count > 0) {
+      ok = publishBatch(now, first);
+      first = false;
     }
+    if (ok) publishTelemetry(temp, hum, dust, mq2);
+
+    mqtt.publish(topicStatus.c_str(), "sleeping", true);
+    mqtt.loop();
+    mqtt.disconnect();
+  }
+
+  Serial.printf("[BATT] Upload %s, %u samples left\n", ok ? "done" : "failed", rtcRing.count);
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  return ok;
+}
+
+// {"id":1,"rows":[[age_s,temp,hum,dust,mq2,flags],...]}, null = missing.
+// Sends the oldest rows that fit one message and drops them from the ring.
+bool publishBatch(uint32_t now, bool withPower) {
+  StaticJsonDocument<384> doc;
+  doc["id"] = DEVICE_ID;
+  if (withPower) describePower(doc.createNestedObject("power"));
+  char head[320];
+  size_t headLen = serializeJson(doc, head, sizeof(head));
+  head[headLen - 1] = ',';  // rows follow
+
+  // The MQTT buffer also holds the fixed header, topic length and topic
+  char buf[BATCH_MQTT_BUFFER];
+  size_t cap = BATCH_MQTT_BUFFER - 7 - topicBatch.length();
+  size_t len;
+  uint8_t rows = encodeBatch(rtcRing, now, head, buf, cap, len);
+  if (rows == 0 || !mqtt.publish(topicBatch.c_str(), buf)) return false;
+
+  rtcRing.consume(rows);
+  return true;
+}
+
+// Model figures from the measured wake times
+void describePower(JsonObject out) {
+  float periodMs = batteryPeriodS * 1000.0f;
+  float sampleMs = min((float)rtcSampleMs, periodMs);
+  float uploadMs = rtcUploadMs > rtcSampleMs ? rtcUploadMs - rtcSampleMs : 0;
+  float avgMa = (PM_SAMPLE_MA * sampleMs + PM_SLEEP_MA * (periodMs - sampleMs) +
+                 PM_UPLOAD_MA * uploadMs / batteryEvery) / periodMs;
+
+  out["avgMa"]    = avgMa;
+  out["days"]     = PM_BATTERY_MAH / avgMa / 24;
+  out["sampleMs"] = rtcSampleMs;
+  out["uploadMs"] = rtcUploadMs;
+  out["periodS"]  = batteryPeriodS;
+  out["every"]    = batteryEvery;
+  out["dropped"]  = rtcRing.dropped;
+  out["fails"]    = rtcUploadFails;
+}
+
+// {"battery":true,"periodS":300,"every":12}. Publish it retained: a
+// device on battery only sees commands during its uploads. A mode
+// change restarts into the new mode.
+bool applyPowerConfig(JsonObject cfg) {
+  bool wasBattery = batteryMode;
+  if (cfg.containsKey("battery")) batteryMode = cfg["battery"];
+  if (cfg.containsKey("periodS")) batteryPeriodS = constrain(cfg["periodS"].as<int>(), 10, 86400);
+  if (cfg.containsKey("every"))   batteryEvery = constrain(cfg["every"].as<int>(), 1, (int)RTC_BUF_LEN);
+  savePrefs();
+
+  if (batteryMode == wasBattery) return false;
+  Serial.printf("[BATT] Battery mode %s\n", batteryMode ? "on" : "off");
+  if (!batteryCycle) {
+    delay(200);
+    ESP.restart();
   }
+  return true;
+}
+
+// Sleep out the rest of the period so samples stay on cadence
+void enterDeepSleep() {
+  digitalWrite(DUSTLEDPIN, HIGH);  // LED is active low; hold it off
+  gpio_hold_en((gpio_num_t)DUSTLEDPIN);
+  gpio_deep_sleep_hold_en();
+
+  int64_t sleepMs = (int64_t)batteryPeriodS * 1000 - millis() - PM_BOOT_MS;
+  if (sleepMs < 1000) sleepMs = 1000;
+  Serial.printf("[BATT] Deep sleep %u ms\n", (uint32_t)sleepMs);
+  Serial.flush();
+
+  esp_sleep_enable_timer_wakeup((uint64_t)sleepMs * 1000);
+  esp_deep_sleep_start();
 }
 
 // -------------------------------------------------------------
 // Loop
 // -------------------------------------------------------------
+// Everything runs in the tasks started by setup()
 void loop() {
-  handleButtons();
+  vTaskDelete(nullptr);
+}
 
-  // WiFi management (non-blocking)
-  if (WiFi.status() != WL_CONNECTED) {
-    connectWiFi();
+// -------------------------------------------------------------
+// Tasks
+// -------------------------------------------------------------
+// Time until the sense task next has work: a sensor coming due, a DHT
+// frame to decode, a beep edge, or a button still down
+uint32_t senseWaitMs(bool buttonsBusy) {
+  uint32_t now = millis();
+  int32_t wait = SENSE_MAX_WAIT_MS;
+
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    wait = min(wait, (int32_t)(schedules[i].nextDue - now));
+  }
+  if (dhtPhase != DHT_IDLE) {
+    wait = min(wait, (int32_t)(dhtStartedAt + schedules[SENSOR_DHT].latencyMs - now));
+  }
+  if (alertActive && buzzerEnabled) {
+    wait = min(wait, (int32_t)(lastBeepTime + 401 - now));
+  }
+  if (buttonsBusy) {
+    wait = min(wait, (int32_t)BUTTON_POLL_MS);
   }
+  return wait > 0 ? wait : 0;
+}
 
-  // MQTT management (only if WiFi connected)
-  if (WiFi.status() == WL_CONNECTED) {
-    if (!mqtt.connected()) {
-      connectMQTT();
+void senseTask(void*) {
+  bool buttonsBusy = false;
+
+  for (;;) {
+    uint32_t waitMs = senseWaitMs(buttonsBusy);
+    uint32_t dueUs = micros() + waitMs * 1000;
+    EventBits_t bits = xEventGroupWaitBits(senseEvents, EV_BUTTON | EV_RECHECK, pdTRUE, pdFALSE,
+                                           pdMS_TO_TICKS(waitMs));
+
+    // Lateness only means something when the deadline woke us
+    uint32_t nowUs = micros();
+    uint32_t late = bits ? 0 : nowUs - dueUs;
+    passLateUs = (int32_t)late > 0 ? late : 0;
+    if (passLateUs > senseLateMaxUs) {
+      senseLateMaxUs = passLateUs;
+      if (passLateUs > 10000) {
+        Serial.printf("[SENSE] Worst wake-up delay: %u us\n", passLateUs);
+      }
     }
-    mqtt.loop();
+    senseWakeups++;
+
+    buttonsBusy = handleButtons();
+    if (!buttonsBusy) {
+      gpio_intr_enable((gpio_num_t)RESET_BUTTON_PIN);
+      gpio_intr_enable((gpio_num_t)BUZZER_BUTTON_PIN);
+    }
+    adoptStagedConfig();
+    serviceSensors();
+    updateAlarms();
+    updateGovernor();
+
+    addBusyTime(micros() - nowUs);
   }
+}
+
+void addBusyTime(uint32_t us) {
+  portENTER_CRITICAL(&busyMux);
+  taskBusyUs += us;
+  portEXIT_CRITICAL(&busyMux);
+}
 
-  // Update sensors and UI (always runs, even offline)
-  static unsigned long lastUpdate = 0;
-  if (millis() - lastUpdate >= 500) {
-    updateSensorsAndUI();
-    lastUpdate = millis();
+void wakeSense() {
+  if (senseEvents) xEventGroupSetBits(senseEvents, EV_RECHECK);
+}
+
+void uiTask(void*) {
+  SensorReport report = {NO_READING, NO_READING, NO_READING, NO_READING, false, !buzzerEnabled};
+
+  for (;;) {
+    xQueueReceive(uiReports, &report, pdMS_TO_TICKS(UI_REFRESH_MS));
+
+    uint32_t t0 = micros();
+    xSemaphoreTake(tftMutex, portMAX_DELAY);
+    esp_pm_lock_acquire(uiPmLock);
+    renderUI(report);
+    esp_pm_lock_release(uiPmLock);
+    xSemaphoreGive(tftMutex);
+    addBusyTime(micros() - t0);
+  }
+}
+
+// Blocks until the broker sends something or maxMs passes. Data already
+// pulled into the client's buffer counts as readable.
+void waitForBroker(uint32_t maxMs) {
+  int fd = mqttNet.fd();
+  if (!mqtt.connected() || fd < 0) {
+    vTaskDelay(pdMS_TO_TICKS(maxMs));
+    return;
+  }
+  if (mqttNet.available()) return;
+
+  fd_set readable;
+  FD_ZERO(&readable);
+  FD_SET(fd, &readable);
+  struct timeval tv;
+  tv.tv_sec  = maxMs / 1000;
+  tv.tv_usec = (maxMs % 1000) * 1000;
+  select(fd + 1, &readable, nullptr, nullptr, &tv);
+}
+
+// Blocking network calls (WiFi join, MQTT connect, NTP) only stall this task
+void netTask(void*) {
+  uint32_t lastClock = 0;
+
+  for (;;) {
+    waitForBroker(NET_MAX_WAIT_MS);
+    uint32_t t0 = micros();
+
+    if (WiFi.status() != WL_CONNECTED) {
+      connectWiFi();
+    }
+
+    bool online = WiFi.status() == WL_CONNECTED;
+    if (online) {
+      if (!mqtt.connected()) {
+        connectMQTT();
+      }
+      mqtt.loop();
+      publishPending();
+    }
+
+    if (millis() - lastClock >= 500) {
+      updateClock(online && internetAvailable);
+      lastClock = millis();
+    }
+
+    addBusyTime(micros() - t0);
   }
 }
 
+void startTasks() {
+  uiReports  = xQueueCreate(1, sizeof(SensorReport));
+  netReports = xQueueCreate(1, sizeof(SensorReport));
+  tftMutex   = xSemaphoreCreateMutex();
+  senseEvents = xEventGroupCreate();
+  esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "ui", &uiPmLock);
+
+  // Buttons wake the sense task, and the chip from light sleep
+  attachInterrupt(digitalPinToInterrupt(RESET_BUTTON_PIN), buttonISR, ONLOW);
+  attachInterrupt(digitalPinToInterrupt(BUZZER_BUTTON_PIN), buttonISR, ONLOW);
+  gpio_wakeup_enable((gpio_num_t)RESET_BUTTON_PIN, GPIO_INTR_LOW_LEVEL);
+  gpio_wakeup_enable((gpio_num_t)BUZZER_BUTTON_PIN, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+
+  xTaskCreatePinnedToCore(senseTask, "sense", 4096, nullptr, SENSE_TASK_PRIO, nullptr, ARDUINO_RUNNING_CORE);
+  xTaskCreatePinnedToCore(uiTask, "ui", 4096, nullptr, UI_TASK_PRIO, nullptr, ARDUINO_RUNNING_CORE);
+  xTaskCreatePinnedToCore(netTask, "net", 8192, nullptr, NET_TASK_PRIO, nullptr, 1 - ARDUINO_RUNNING_CORE);
+  Serial.println("[TASK] sense/ui/net started");
+}
+
 // -------------------------------------------------------------
 // UI Drawing Functions
 // -------------------------------------------------------------
@@ -1095,12 +2582,13 @@ void drawCards(int temp, int hum, int dust, int mq2) {
     tft.fillRect(x + 2, CARDS_Y + 16, CARD_W - 4, CARD_H - 34, COL_CARD);
 
     uint16_t fg = alerts[i] ? COL_WARN : COL_TEXT;
-    String valStr = String(values[i]);
+    String valStr = values[i] == NO_READING ? String("--") : String(values[i]);
     int font = 4;
     if (valStr.length() >= 4) font = 2;
 
     drawCentered(x + CARD_W/2, CARDS_Y + CARD_H/2, valStr, font, fg, COL_CARD);
     *lastVals[i] = values[i];
+    cardRedraws++;
   }
 }
 
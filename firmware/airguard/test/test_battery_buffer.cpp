@@ -0,0 +1,133 @@
+// -------------------------------------------------------------
+// Host test for battery_buffer.h
+// -------------------------------------------------------------
+// g++ -std=c++11 -Wall -o /tmp/test_battery_buffer test_battery_buffer.cpp && /tmp/test_battery_buffer
+#include "../battery_buffer.h"
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+static PackedSample sampleAt(uint32_t t) {
+  SampleReading r = {21.5f, 40, 12, 300, 0};
+  return packSample(t, r);
+}
+
+static void testRingWrap() {
+  static SampleRing ring;
+  ring.clear();
+  CHECK(ring.count == 0);
+
+  for (uint32_t t = 0; t < RTC_BUF_LEN; t++) ring.push(sampleAt(t));
+  CHECK(ring.count == RTC_BUF_LEN && ring.dropped == 0 && ring.head == 0);
+  CHECK(ring.at(0).t == 0 && ring.at(RTC_BUF_LEN - 1).t == RTC_BUF_LEN - 1);
+
+  // Overflow drops the oldest, keeps order
+  for (uint32_t t = RTC_BUF_LEN; t < RTC_BUF_LEN + 5; t++) ring.push(sampleAt(t));
+  CHECK(ring.count == RTC_BUF_LEN && ring.dropped == 5 && ring.head == 5);
+  CHECK(ring.at(0).t == 5 && ring.at(RTC_BUF_LEN - 1).t == RTC_BUF_LEN + 4);
+
+  // Consuming across the wrap point
+  ring.consume(RTC_BUF_LEN - 2);
+  CHECK(ring.count == 2 && ring.at(0).t == RTC_BUF_LEN + 3);
+  ring.push(sampleAt(1000));
+  CHECK(ring.count == 3 && ring.at(2).t == 1000);
+  ring.consume(10);
+  CHECK(ring.count == 0);
+}
+
+static void testPackRoundTrip() {
+  SampleReading in = {-12.34f, 55.4f, 87, 412, 0x05};
+  SampleReading out = unpackSample(packSample(100, in));
+  CHECK(fabsf(out.temp - -12.3f) < 1e-4f && out.hum == 55 && out.dust == 87 && out.mq2 == 412 && out.flags == 0x05);
+
+  // Missing values survive as missing
+  SampleReading none = {NAN, NAN, -1, -1, 0};
+  PackedSample p = packSample(100, none);
+  CHECK(p.temp10 == PACKED_NO_TEMP && p.hum == PACKED_NO_HUM && p.dust == PACKED_NONE && p.mq2 == PACKED_NONE);
+  out = unpackSample(p);
+  CHECK(isnan(out.temp) && isnan(out.hum) && out.dust < 0 && out.mq2 < 0);
+
+  // Out of range saturates short of the markers
+  SampleReading big = {5000, 140, 70000, 65535, 0};
+  p = packSample(100, big);
+  CHECK(p.temp10 == INT16_MAX && p.hum == 100 && p.dust == PACKED_NONE - 1 && p.mq2 == PACKED_NONE - 1);
+  SampleReading low = {-5000, -3, 0, 0, 0};
+  p = packSample(100, low);
+  CHECK(p.temp10 == INT16_MIN + 1 && p.hum == 0 && p.dust == 0 && p.mq2 == 0);
+}
+
+static void testRowEncoding() {
+  char row[48];
+  SampleReading r = {-0.5f, 40, 12, 300, 3};
+  encodeRow(packSample(90, r), 100, row, sizeof(row));
+  CHECK(strcmp(row, "[10,-0.5,40,12,300,3]") == 0);
+
+  SampleReading none = {NAN, NAN, -1, -1, 0};
+  encodeRow(packSample(100, none), 100, row, sizeof(row));
+  CHECK(strcmp(row, "[0,null,null,null,null,0]") == 0);
+}
+
+static void testBatchSplit() {
+  static SampleRing ring;
+  ring.clear();
+  for (uint32_t t = 0; t < 30; t++) ring.push(sampleAt(t));
+
+  // Row limit: 30 samples go out as 12 + 12 + 6
+  char buf[BATCH_MQTT_BUFFER];
+  size_t len;
+  const uint8_t expect[] = {12, 12, 6};
+  for (uint8_t i = 0; i < 3; i++) {
+    uint8_t first = ring.at(0).t;
+    uint8_t rows = encodeBatch(ring, 100, "{\"id\":1,", buf, sizeof(buf), len);
+    CHECK(rows == expect[i] && len == strlen(buf) && len < sizeof(buf));
+    CHECK(strncmp(buf, "{\"id\":1,\"rows\":[[", 16) == 0 && strcmp(buf + len - 2, "]}") == 0);
+    char firstRow[16];
+    snprintf(firstRow, sizeof(firstRow), "[[%u,", 100 - first);
+    CHECK(strstr(buf, firstRow) != nullptr);
+    ring.consume(rows);
+  }
+  CHECK(ring.count == 0);
+
+  // Byte limit: widest rows under a long head stop short of 12 rows
+  ring.clear();
+  SampleReading wide = {-3276.7f, 100, 65534, 65534, 255};
+  for (uint8_t i = 0; i < 20; i++) ring.push(packSample(0, wide));
+  char head[700];
+  memset(head, ' ', sizeof(head));
+  head[0] = '{';
+  strcpy(head + sizeof(head) - 9, "\"id\":1,");
+  uint8_t rows = encodeBatch(ring, 4000000000u, head, buf, sizeof(buf), len);
+  CHECK(rows > 0 && rows < BATCH_ROWS && len < sizeof(buf));
+  CHECK(strcmp(buf + len - 2, "]}") == 0);
+
+  // One more row would not have fit
+  char row[48];
+  int n = encodeRow(ring.at(0), 4000000000u, row, sizeof(row));
+  CHECK(len + 1 + n >= sizeof(buf));
+
+  // Nothing fits: no rows, nothing to send
+  rows = encodeBatch(ring, 0, head, buf, strlen(head) + 12, len);
+  CHECK(rows == 0 && len == 0);
+}
+
+int main() {
+  testRingWrap();
+  testPackRoundTrip();
+  testRowEncoding();
+  testBatchSplit();
+
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("battery_buffer: all checks passed\n");
+  return 0;
+}
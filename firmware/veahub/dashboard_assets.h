@@ -0,0 +1,145 @@
+// Generated by tools/build_dashboard.py from web/ - do not edit.
+#pragma once
+#include <Arduino.h>
+
+struct DashboardAsset {
+  const char* path;
+  const char* contentType;
+  const char* etag;
+  const uint8_t* data;  // gzip
+  size_t length;
+};
+
+static const uint8_t ASSET_APP_CSS_GZ[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xad, 0x53, 0x5d, 0x6f, 0xe3, 0x20,
+  0x10, 0x7c, 0xef, 0xaf, 0x40, 0xba, 0xb7, 0x93, 0x38, 0xd9, 0xae, 0x5b, 0x55, 0xce, 0xaf, 0x59,
+  0x9b, 0xc5, 0xe6, 0x0e, 0x83, 0x05, 0xb8, 0x49, 0xae, 0xea, 0x7f, 0xef, 0x82, 0x3f, 0xe2, 0x24,
+  0x3e, 0xb5, 0x95, 0x2e, 0x4f, 0x0e, 0xec, 0xce, 0xcc, 0xce, 0x2c, 0x3f, 0xd9, 0x1b, 0xab, 0xed,
+  0x89, 0x7b, 0xf5, 0x57, 0x99, 0xb6, 0xa2, 0x6f, 0x27, 0xd0, 0x71, 0x3a, 0x3a, 0xb0, 0x1e, 0x5c,
+  0xab, 0x4c, 0xc5, 0xb2, 0x03, 0x1b, 0x40, 0x88, 0x74, 0x4f, 0xdf, 0xef, 0x0f, 0xb5, 0x15, 0x67,
+  0xea, 0x93, 0xd6, 0x04, 0x2e, 0xa1, 0x57, 0xfa, 0x5c, 0x31, 0x7f, 0xf6, 0x01, 0x7b, 0x3e, 0xaa,
+  0x03, 0xab, 0xa1, 0xf9, 0xd3, 0x3a, 0x3b, 0x1a, 0x51, 0xb1, 0x1f, 0x39, 0xe4, 0x50, 0xe0, 0x81,
+  0x35, 0x56, 0x5b, 0x47, 0xff, 0x11, 0x71, 0x03, 0x57, 0x64, 0xc3, 0x29, 0x22, 0xfe, 0x6a, 0x08,
+  0x0b, 0x94, 0x41, 0x47, 0xb8, 0x3d, 0x9c, 0xf8, 0x51, 0x89, 0xd0, 0x55, 0xec, 0x25, 0x4b, 0x05,
+  0xab, 0x12, 0x06, 0x63, 0xb0, 0xb1, 0xa1, 0xcb, 0xa9, 0x70, 0xc1, 0xcc, 0x32, 0x51, 0x4a, 0xb9,
+  0x94, 0x91, 0xf8, 0x10, 0x6c, 0x5f, 0xb1, 0x7c, 0x01, 0xf7, 0x01, 0xc2, 0xe8, 0xe3, 0xa4, 0x57,
+  0xca, 0x9e, 0x8b, 0xfc, 0x71, 0x2b, 0x26, 0x7f, 0x8a, 0xf5, 0xb3, 0x03, 0x0e, 0x84, 0x1a, 0x3d,
+  0x29, 0xb8, 0xf0, 0xaf, 0xc0, 0xc5, 0x35, 0x30, 0x57, 0x34, 0x39, 0xa1, 0x0b, 0xe5, 0x07, 0x0d,
+  0xe4, 0x85, 0xd4, 0x48, 0xf7, 0xbf, 0x47, 0x1f, 0x94, 0x3c, 0xf3, 0x38, 0x1a, 0x9a, 0x40, 0x16,
+  0x0d, 0xd0, 0x20, 0xaf, 0x31, 0x1c, 0x11, 0xcd, 0x86, 0x97, 0x28, 0xa2, 0xaf, 0xab, 0xf5, 0xb3,
+  0x7a, 0x3a, 0xf5, 0x56, 0x2b, 0x41, 0xf3, 0xc9, 0xc7, 0xf2, 0x39, 0xbb, 0x65, 0xac, 0x34, 0xf8,
+  0xc0, 0x9b, 0x4e, 0x69, 0x91, 0x42, 0xbc, 0xea, 0x36, 0xd6, 0x60, 0x6a, 0xd0, 0x50, 0xa3, 0xde,
+  0x78, 0x05, 0x00, 0xe9, 0xfc, 0x15, 0xf4, 0x88, 0x3b, 0x1e, 0xa6, 0x50, 0x8f, 0xa8, 0xda, 0x2e,
+  0xc4, 0x6d, 0xd0, 0x62, 0xa2, 0xc5, 0x26, 0x28, 0x6b, 0x3e, 0xb5, 0x70, 0x72, 0xe6, 0x5b, 0x16,
+  0xce, 0xc8, 0x5d, 0xf1, 0x85, 0x40, 0x9f, 0xe6, 0x26, 0x37, 0x6a, 0xfc, 0x7f, 0x71, 0xae, 0x7b,
+  0x12, 0x61, 0x79, 0x87, 0x20, 0xd2, 0x1a, 0x7e, 0x33, 0x4e, 0xd0, 0xaa, 0x35, 0x29, 0x18, 0xa2,
+  0x69, 0xa8, 0x02, 0xdd, 0x27, 0x4c, 0x84, 0x24, 0xd4, 0x6c, 0xeb, 0xd7, 0x62, 0x48, 0x6d, 0xd0,
+  0xdc, 0xf4, 0xa4, 0x48, 0x53, 0x03, 0xbd, 0x62, 0x24, 0x96, 0x72, 0x66, 0xa9, 0xc3, 0x5d, 0x62,
+  0x0b, 0xfe, 0xd2, 0xbb, 0x3c, 0xcf, 0xc9, 0xa6, 0x65, 0x6f, 0x2e, 0x1e, 0x92, 0xe0, 0xfd, 0x50,
+  0x93, 0xb9, 0xcd, 0xe8, 0x7c, 0x84, 0x19, 0xac, 0x9a, 0xe6, 0xdd, 0x97, 0x4d, 0x3a, 0xaa, 0xce,
+  0xbe, 0x26, 0x57, 0x6f, 0xd4, 0xd4, 0x2f, 0xa2, 0x8c, 0x35, 0xd2, 0xba, 0x9e, 0xcd, 0x82, 0x67,
+  0xd3, 0x82, 0x1d, 0x36, 0x8e, 0xd1, 0x15, 0x17, 0xa8, 0x31, 0xdc, 0x05, 0x2f, 0x65, 0x49, 0xbf,
+  0x75, 0xa4, 0x63, 0x47, 0x19, 0xfc, 0x73, 0x20, 0x92, 0xbd, 0xbf, 0x18, 0xfb, 0xf3, 0xbc, 0x3f,
+  0xc0, 0x4e, 0x38, 0x01, 0x4f, 0x81, 0xc4, 0x34, 0xd6, 0x41, 0x8c, 0xe2, 0xf2, 0xda, 0x60, 0x1d,
+  0xf3, 0xae, 0x84, 0xb4, 0xa2, 0xd3, 0x6a, 0xaa, 0xfb, 0x00, 0x38, 0x64, 0x6a, 0x0f, 0x76, 0x05,
+  0x00, 0x00,
+};
+
+static const uint8_t ASSET_INDEX_HTML_GZ[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xb5, 0x58, 0xcd, 0x6e, 0xdb, 0x46,
+  0x10, 0xbe, 0xe7, 0x29, 0x26, 0x2a, 0x0a, 0x49, 0x68, 0x24, 0xd9, 0x46, 0x03, 0x04, 0xfa, 0x61,
+  0x61, 0x3b, 0x0e, 0x62, 0x34, 0x6e, 0x1c, 0xc8, 0x6d, 0x51, 0x04, 0x3d, 0x2c, 0xc9, 0xa1, 0xb8,
+  0xd5, 0x92, 0xcb, 0xec, 0x2e, 0xe5, 0xa8, 0x45, 0x5e, 0xa0, 0x3d, 0xf4, 0xd0, 0x07, 0x48, 0x1f,
+  0x31, 0x8f, 0xd0, 0xd9, 0x5d, 0x52, 0x22, 0x6d, 0x27, 0xb6, 0xdc, 0xe4, 0x62, 0x91, 0xbb, 0xf3,
+  0xf3, 0xed, 0xec, 0xcc, 0x37, 0x43, 0x4f, 0x1f, 0x3e, 0x7d, 0x79, 0x7c, 0xf1, 0xcb, 0xf9, 0x09,
+  0xa4, 0x26, 0x13, 0xc1, 0x83, 0x69, 0xfd, 0x83, 0x2c, 0x0e, 0x1e, 0x00, 0x4c, 0x33, 0x34, 0x0c,
+  0xa2, 0x94, 0x29, 0x8d, 0x66, 0xd6, 0x29, 0x4d, 0x32, 0x78, 0xd2, 0xd9, 0x6e, 0xe4, 0x2c, 0xc3,
+  0x59, 0x67, 0xc5, 0xf1, 0xb2, 0x90, 0xca, 0x74, 0x20, 0x92, 0xb9, 0xc1, 0x9c, 0x04, 0x2f, 0x79,
+  0x6c, 0xd2, 0x59, 0x8c, 0x2b, 0x1e, 0xe1, 0xc0, 0xbd, 0x3c, 0xe2, 0x39, 0x37, 0x9c, 0x89, 0x81,
+  0x8e, 0x98, 0xc0, 0xd9, 0xbe, 0xb7, 0x62, 0xb8, 0x11, 0x18, 0xfc, 0x84, 0xec, 0x79, 0x19, 0xc2,
+  0xb1, 0x94, 0x2a, 0xe6, 0x39, 0x33, 0x52, 0x4d, 0x47, 0x7e, 0xc7, 0xca, 0x08, 0x9e, 0x2f, 0x41,
+  0xa1, 0x98, 0x75, 0xb4, 0x59, 0x0b, 0xd4, 0x29, 0x22, 0xb9, 0x4a, 0x15, 0x26, 0xb3, 0xce, 0x88,
+  0x15, 0xc5, 0x30, 0xd2, 0x9a, 0xac, 0x4d, 0x47, 0x1e, 0xf4, 0x34, 0x94, 0xf1, 0xda, 0x29, 0xc6,
+  0x7c, 0x05, 0x91, 0x60, 0x5a, 0xcf, 0x3a, 0x16, 0x18, 0xe3, 0x39, 0x2a, 0xe7, 0x96, 0xf6, 0xd2,
+  0xfd, 0xe0, 0xc3, 0xfb, 0xbf, 0xff, 0x85, 0x9b, 0x5c, 0xd3, 0x9e, 0x17, 0x2a, 0xc0, 0x79, 0xb4,
+  0xea, 0x42, 0xaa, 0xf1, 0x57, 0x8c, 0xb1, 0x49, 0xc6, 0xd4, 0x82, 0xe7, 0x83, 0x50, 0x1a, 0x23,
+  0xb3, 0xf1, 0xc1, 0x5e, 0xf1, 0x76, 0xd2, 0x09, 0x5e, 0x48, 0x3a, 0x14, 0x64, 0x84, 0x0d, 0x72,
+  0x34, 0x97, 0x52, 0x2d, 0x5d, 0x28, 0x94, 0x14, 0x02, 0x15, 0x24, 0x52, 0x39, 0x3f, 0x32, 0x43,
+  0xf0, 0x21, 0xd1, 0xd3, 0x51, 0x11, 0x3c, 0xf0, 0x4e, 0x1a, 0x28, 0xb5, 0x61, 0xa6, 0xd4, 0x15,
+  0x44, 0x0b, 0xf2, 0xa0, 0x06, 0xd0, 0xf6, 0xba, 0xff, 0xd8, 0x79, 0x9d, 0xaf, 0xb5, 0xc1, 0x0c,
+  0xe6, 0x4e, 0x8b, 0x60, 0x1f, 0x6c, 0x14, 0xaf, 0xd9, 0x1c, 0x70, 0x92, 0xdc, 0x18, 0x26, 0x09,
+  0x5d, 0xb0, 0xbc, 0x16, 0x11, 0x2c, 0x44, 0xd1, 0x09, 0xce, 0x64, 0x8c, 0xd3, 0x91, 0xdd, 0xf8,
+  0x88, 0xdc, 0x8a, 0x89, 0x12, 0x49, 0xee, 0x64, 0xfe, 0x1c, 0x0e, 0xcf, 0xdb, 0xa2, 0xd3, 0x11,
+  0xf9, 0xfc, 0x7f, 0xfe, 0xe7, 0xf3, 0xd3, 0xa7, 0x77, 0xf0, 0x0f, 0x31, 0x33, 0x6c, 0x60, 0xcd,
+  0x92, 0x71, 0xcd, 0xe3, 0x4e, 0x30, 0xf8, 0xec, 0x50, 0x4e, 0xcf, 0xe1, 0x30, 0x8e, 0x15, 0x6a,
+  0xbd, 0x23, 0x20, 0x5e, 0x7c, 0x09, 0x38, 0x67, 0xaf, 0x2e, 0x2e, 0xe0, 0x48, 0xc9, 0x25, 0xaa,
+  0x1d, 0xf1, 0x84, 0x4e, 0xe9, 0x4b, 0x60, 0x3a, 0x96, 0x79, 0x8e, 0x91, 0xc1, 0x18, 0x9e, 0xd6,
+  0x29, 0xbd, 0x13, 0xb2, 0x48, 0x70, 0x62, 0x0a, 0xfd, 0x25, 0xa0, 0xfd, 0x58, 0x18, 0x9e, 0xdd,
+  0x29, 0x95, 0xfd, 0x5a, 0x03, 0x55, 0xe9, 0x54, 0xb7, 0xa0, 0x40, 0x23, 0x15, 0x72, 0xac, 0x3f,
+  0x8a, 0xb1, 0x7a, 0xbc, 0x5e, 0xca, 0x14, 0x1b, 0x2e, 0xf3, 0x66, 0x2d, 0x07, 0xaf, 0x4a, 0x1e,
+  0x2d, 0xe1, 0x05, 0xd1, 0x59, 0xbb, 0x5a, 0x8b, 0x60, 0xca, 0x36, 0x7c, 0x56, 0x52, 0x81, 0x33,
+  0xab, 0x4a, 0xa1, 0xf9, 0xf0, 0xfe, 0x9f, 0xbf, 0xe0, 0x8c, 0xe5, 0x6c, 0x81, 0x70, 0xb8, 0xdd,
+  0x98, 0x8e, 0x58, 0xe0, 0x08, 0xe4, 0x06, 0x7d, 0x7b, 0x0c, 0xaf, 0xf9, 0x67, 0x75, 0x31, 0x8e,
+  0x1f, 0xb8, 0x36, 0x3c, 0x6a, 0x2b, 0xee, 0x82, 0xfc, 0x58, 0xc8, 0x32, 0xa6, 0x0c, 0xe4, 0xf1,
+  0x02, 0xdb, 0xd0, 0x6f, 0x65, 0xc8, 0x7d, 0xcf, 0x90, 0xcf, 0xa4, 0xba, 0x64, 0x2a, 0xa6, 0x78,
+  0x0a, 0x9f, 0x35, 0x46, 0x16, 0x84, 0x88, 0x7e, 0xc0, 0xa4, 0x48, 0xbe, 0xad, 0x03, 0x9f, 0xad,
+  0x20, 0x57, 0xf4, 0x67, 0x2d, 0x4b, 0x05, 0xa9, 0xa5, 0xcc, 0x9f, 0xf9, 0xe0, 0x19, 0x1f, 0xc2,
+  0x19, 0x55, 0x23, 0x05, 0x42, 0x03, 0x53, 0x08, 0x4b, 0x2c, 0x0c, 0xc8, 0xdc, 0xe9, 0xa6, 0xc4,
+  0xdf, 0x97, 0x29, 0x17, 0xe8, 0xde, 0x38, 0x75, 0x20, 0x45, 0x24, 0x0c, 0x5c, 0x43, 0x2c, 0x2f,
+  0xf3, 0x61, 0x33, 0x52, 0xf7, 0xe3, 0xa5, 0x8a, 0x5f, 0x6f, 0x4f, 0x6f, 0x1e, 0xdb, 0x8a, 0xb3,
+  0x41, 0x1a, 0xd4, 0x54, 0xfe, 0xf9, 0xb3, 0xfb, 0x88, 0x45, 0x4b, 0x21, 0x17, 0x3b, 0xe2, 0x09,
+  0xbd, 0xd6, 0x2d, 0x80, 0xa8, 0x53, 0x65, 0xd4, 0xc6, 0x4c, 0x2a, 0x49, 0xf3, 0xfc, 0xe5, 0xfc,
+  0xa2, 0x03, 0xcc, 0x65, 0x03, 0x65, 0x96, 0x37, 0xd4, 0xb9, 0xd2, 0x91, 0xe8, 0x1a, 0xeb, 0x2b,
+  0xde, 0x42, 0xa1, 0x84, 0x74, 0x60, 0x83, 0x29, 0xcf, 0x8b, 0xd2, 0x80, 0x59, 0x17, 0x36, 0x45,
+  0x52, 0x8c, 0x96, 0xa1, 0x7c, 0xdb, 0xa9, 0xc6, 0x06, 0xcc, 0x59, 0x28, 0x30, 0x6e, 0xc1, 0xac,
+  0xd7, 0x02, 0x38, 0x71, 0x4f, 0x10, 0x56, 0x39, 0x57, 0xd9, 0xdb, 0xde, 0x65, 0xd3, 0xcd, 0xf3,
+  0x4d, 0x9a, 0x80, 0x6d, 0x22, 0xe3, 0x69, 0xa8, 0xda, 0xae, 0x0d, 0xbe, 0x35, 0xb5, 0x5b, 0xd7,
+  0x33, 0x5a, 0x57, 0xe5, 0x16, 0xaa, 0x63, 0xb9, 0x59, 0x85, 0x4e, 0xb4, 0xf7, 0xf5, 0xa4, 0x60,
+  0x31, 0x8d, 0x04, 0x8b, 0xf1, 0x13, 0x3a, 0x5d, 0xe3, 0xb4, 0xbe, 0xf7, 0xde, 0x82, 0xe8, 0x9c,
+  0xae, 0x81, 0xc6, 0x80, 0x18, 0x7a, 0x02, 0xd9, 0x0a, 0x01, 0xb3, 0xc2, 0xac, 0x6d, 0xb2, 0x2f,
+  0x11, 0x8b, 0xfe, 0x75, 0x80, 0x45, 0x25, 0x5f, 0x83, 0xdc, 0xbe, 0x7f, 0x5e, 0x5c, 0x17, 0xae,
+  0xea, 0x3e, 0x1d, 0x20, 0x5f, 0x99, 0xad, 0x10, 0xd5, 0x4b, 0x9f, 0x05, 0x4c, 0x58, 0x12, 0x31,
+  0xe4, 0x95, 0x63, 0x5d, 0x86, 0x19, 0xb7, 0x93, 0xa3, 0x4f, 0xdc, 0xd0, 0x10, 0xf1, 0xcc, 0x6d,
+  0xc4, 0x6a, 0xb2, 0xf1, 0xd2, 0xdb, 0x74, 0xb5, 0x29, 0x7a, 0x0f, 0x02, 0x93, 0x79, 0xc2, 0x17,
+  0xa5, 0x72, 0x04, 0x7a, 0x3f, 0x06, 0xab, 0x1a, 0x9e, 0x27, 0xa6, 0x6a, 0x8c, 0xf3, 0xf4, 0x45,
+  0x4c, 0x53, 0x4d, 0x7d, 0xe3, 0x2b, 0xb4, 0xac, 0x69, 0x04, 0xcc, 0x17, 0x81, 0x4f, 0xca, 0x51,
+  0xf5, 0x06, 0xd7, 0xba, 0x4e, 0x7b, 0x8c, 0xb9, 0xd9, 0x46, 0x9d, 0x51, 0x9f, 0xb2, 0xb3, 0xc9,
+  0x9a, 0x9b, 0x6d, 0x7d, 0xfc, 0xa4, 0x8d, 0x2a, 0x6e, 0xcc, 0x1a, 0xe3, 0xeb, 0x1e, 0xae, 0xce,
+  0x13, 0x57, 0xbb, 0x49, 0xf3, 0x41, 0x47, 0x8a, 0x17, 0xc6, 0x6f, 0x8f, 0x46, 0xd4, 0xc7, 0xd4,
+  0xb2, 0x2c, 0x2c, 0x2d, 0x6b, 0x54, 0x2b, 0xea, 0x00, 0x8b, 0xdf, 0x79, 0x51, 0xd0, 0x6f, 0xa2,
+  0x64, 0x06, 0x09, 0xdd, 0x5d, 0x3a, 0x01, 0xc1, 0xe9, 0xea, 0x1d, 0x7b, 0x69, 0x9a, 0xa0, 0xa9,
+  0xaa, 0xdd, 0x26, 0x4d, 0xf9, 0xdc, 0x77, 0x36, 0x67, 0x2c, 0x29, 0x73, 0x77, 0xc3, 0xf4, 0x51,
+  0x90, 0xd0, 0x8c, 0x96, 0xf6, 0xfa, 0xf0, 0x47, 0x75, 0xc8, 0x04, 0x4d, 0x94, 0xf6, 0xba, 0x5b,
+  0x85, 0x6e, 0x7f, 0x48, 0x5d, 0x21, 0xef, 0x6d, 0x74, 0x7a, 0x8a, 0xa4, 0x49, 0xd3, 0x94, 0x8a,
+  0x0c, 0x0c, 0x7f, 0xd3, 0x32, 0xef, 0xf5, 0x27, 0xf0, 0xee, 0x9a, 0x9c, 0xde, 0x5a, 0x05, 0xd0,
+  0xc3, 0xaa, 0x37, 0xcd, 0xe8, 0x91, 0x17, 0xf0, 0x0d, 0x74, 0xc7, 0x5d, 0xfa, 0xab, 0x87, 0xd9,
+  0x1b, 0x63, 0xce, 0xe9, 0xe3, 0x67, 0xb2, 0x91, 0x8d, 0x65, 0x54, 0x66, 0x34, 0xdb, 0x0c, 0xdf,
+  0x94, 0xa8, 0xd6, 0x73, 0xd7, 0xf0, 0xa4, 0x3a, 0x14, 0xa2, 0xd7, 0x7d, 0xbd, 0x09, 0xe5, 0xaf,
+  0x04, 0x8c, 0x52, 0xf9, 0x84, 0x11, 0xdc, 0xad, 0x4f, 0x14, 0x4d, 0xa7, 0x40, 0x91, 0x50, 0xb0,
+  0xb2, 0x3e, 0x5f, 0xa3, 0x18, 0x2e, 0xd0, 0x1c, 0x1a, 0xa3, 0x38, 0x55, 0x04, 0xf6, 0xba, 0x1b,
+  0x4b, 0xdd, 0xfe, 0xaf, 0x93, 0x86, 0x0a, 0x4f, 0xa0, 0xb7, 0x82, 0x87, 0xb3, 0x19, 0x94, 0x79,
+  0x8c, 0x09, 0x7d, 0xf3, 0xc4, 0x7d, 0x20, 0x6d, 0x5b, 0xe1, 0xc7, 0xfe, 0xf3, 0x8c, 0x0c, 0xae,
+  0xb6, 0x2a, 0xef, 0xfa, 0xf5, 0x33, 0xc5, 0x20, 0x62, 0xa6, 0x05, 0x88, 0xe0, 0xd4, 0xfb, 0xef,
+  0x6e, 0x8c, 0xbd, 0x2f, 0xd3, 0x5e, 0xc2, 0x95, 0x36, 0x37, 0x5f, 0x83, 0xa7, 0x90, 0xfb, 0xdf,
+  0x43, 0xd8, 0x0c, 0xc9, 0x26, 0xb6, 0x14, 0x8c, 0x13, 0x81, 0xf6, 0xf1, 0x68, 0x7d, 0x1a, 0xf7,
+  0xba, 0xad, 0xb6, 0x6b, 0x9d, 0x35, 0x8f, 0xdb, 0x08, 0xcf, 0xc3, 0x70, 0x58, 0xf5, 0x18, 0xf8,
+  0x0e, 0xba, 0x2f, 0x93, 0xa4, 0x0b, 0x63, 0x08, 0x87, 0x7e, 0xfe, 0xa0, 0x95, 0xcd, 0x58, 0xeb,
+  0xd7, 0xcb, 0xc2, 0x7d, 0x7d, 0x6e, 0x37, 0x88, 0xeb, 0x6c, 0xd1, 0x3b, 0x79, 0x2b, 0xd2, 0xfd,
+  0x41, 0x82, 0x17, 0xea, 0x4e, 0xee, 0x8c, 0xb2, 0x6a, 0xc6, 0x9f, 0x80, 0x19, 0x0e, 0xe9, 0x24,
+  0x0b, 0x02, 0x49, 0x89, 0x06, 0xfe, 0xf1, 0x11, 0xd8, 0x84, 0xa3, 0x8d, 0x42, 0x4a, 0x71, 0x64,
+  0xef, 0x89, 0x6a, 0xc4, 0x6e, 0x87, 0xd5, 0x73, 0xcf, 0xee, 0x9f, 0x31, 0x93, 0x0e, 0x95, 0xa4,
+  0xbb, 0xef, 0xd5, 0xa2, 0x6b, 0x43, 0x9b, 0x23, 0xd8, 0xdf, 0x3b, 0xf8, 0xb6, 0xef, 0x14, 0xbe,
+  0x3f, 0xea, 0x37, 0xc0, 0xda, 0x84, 0xb9, 0x72, 0x7d, 0x77, 0x39, 0x43, 0x15, 0x45, 0x3a, 0x83,
+  0xeb, 0xeb, 0x04, 0x75, 0x06, 0x9b, 0xd8, 0x4e, 0x76, 0x30, 0x64, 0xc9, 0x8f, 0xac, 0xb8, 0xa2,
+  0x77, 0x36, 0xec, 0xc2, 0x2e, 0x06, 0x7c, 0x73, 0x6a, 0x99, 0xf0, 0x4b, 0x8d, 0x1c, 0xdf, 0x21,
+  0xc3, 0x37, 0xa4, 0x32, 0x69, 0xbe, 0x56, 0x79, 0x6e, 0x54, 0x89, 0xd5, 0x86, 0x46, 0x73, 0x6a,
+  0x67, 0x4d, 0xf2, 0xda, 0x36, 0xd7, 0xb0, 0x70, 0xb5, 0x4a, 0x98, 0xd0, 0x68, 0x93, 0xfc, 0x11,
+  0x3c, 0xde, 0xdb, 0xdb, 0x73, 0x86, 0x88, 0x48, 0x2b, 0x9e, 0xa4, 0x5e, 0xe7, 0xfe, 0x73, 0x41,
+  0xed, 0xc9, 0xfd, 0x13, 0xe6, 0x3f, 0x24, 0x65, 0xeb, 0x64, 0x9c, 0x11, 0x00, 0x00,
+};
+
+static const DashboardAsset DASHBOARD_ASSETS[] = {
+  { "/app.css", "text/css", "\"127fa2ba2cd9a291\"", ASSET_APP_CSS_GZ, sizeof(ASSET_APP_CSS_GZ) },  // 1398 -> 498 bytes
+  { "/", "text/html", "\"ea6b702539fd5318\"", ASSET_INDEX_HTML_GZ, sizeof(ASSET_INDEX_HTML_GZ) },  // 4508 -> 1438 bytes
+};
+static const size_t DASHBOARD_ASSET_COUNT = sizeof(DASHBOARD_ASSETS) / sizeof(DASHBOARD_ASSETS[0]);
@@ -0,0 +1,144 @@
+"""Measure hub MQTT routing latency while the web server is under load.
+
+Two broker clients are connected to the hub. One publishes timestamped
+messages and the other times how long the broker takes to forward them.
+Meanwhile, worker threads fetch dashboard/API pages, and "slow" workers
+trickle a form POST byte by byte the way a phone on a weak link does.
+
+    python firmware/veahub/tools/bench_http_mqtt.py --host 192.168.10.1 \
+        --http-workers 4 --slow-workers 2 --duration 30
+
+Run once with --http-workers 0 --slow-workers 0 for a baseline.
+"""
+import argparse
+import socket
+import statistics
+import threading
+import time
+
+PAGES = ["/", "/app.css", "/automations", "/api/stats", "/api/rules", "/api/state"]
+SLOW_BODY = b"source=vealive%2Fbench%2F1%2Ftelemetry&condition=temp+%3E+99&target=bench%2Fout&payload=x"
+
+
+def http_worker(host, stop, counters):
+    i = 0
+    while not stop.is_set():
+        path = PAGES[i % len(PAGES)]
+        i += 1
+        try:
+            with socket.create_connection((host, 80), timeout=5) as s:
+                s.sendall(("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % (path, host)).encode())
+                status = s.recv(16)
+                while s.recv(4096):
+                    pass
+            counters["ok" if b" 200 " in status or b" 304 " in status else "other"] += 1
+        except OSError:
+            counters["errors"] += 1
+
+
+def slow_worker(host, stop, counters, byte_delay):
+    # Stays below the hub's request timeout so the request completes
+    head = ("POST /backtest HTTP/1.1\r\nHost: %s\r\n"
+            "Content-Type: application/x-www-form-urlencoded\r\n"
+            "Content-Length: %d\r\n\r\n" % (host, len(SLOW_BODY))).encode()
+    while not stop.is_set():
+        try:
+            with socket.create_connection((host, 80), timeout=10) as s:
+                s.sendall(head)
+                for b in SLOW_BODY:
+                    if stop.is_set():
+                        return
+                    s.send(bytes([b]))
+                    time.sleep(byte_delay)
+                s.recv(4096)
+            counters["slow"] += 1
+        except OSError:
+            counters["errors"] += 1
+
+
+def mqtt_client(host, port):
+    s = socket.create_connection((host, port), timeout=5)
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    return s
+
+
+def measure(host, port, duration, interval):
+    pub = mqtt_client(host, port)
+    sub = mqtt_client(host, port)
+    sub.settimeout(2)
+    time.sleep(0.5)
+
+    latencies = []
+    lost = 0
+    buf = b""
+    seq = 0
+    deadline = time.time() + duration
+    while time.time() < deadline:
+        seq += 1
+        sent = time.perf_counter()
+        pub.sendall(b"bench/latency|%d\n" % seq)
+        try:
+            while True:
+                while b"\n" not in buf:
+                    chunk = sub.recv(1024)
+                    if not chunk:
+                        raise OSError("broker closed the connection")
+                    buf += chunk
+                line, buf = buf.split(b"\n", 1)
+                if line.strip() == b"bench/latency|%d" % seq:
+                    latencies.append((time.perf_counter() - sent) * 1000)
+                    break
+        except socket.timeout:
+            lost += 1
+        time.sleep(interval)
+
+    pub.close()
+    sub.close()
+    return latencies, lost
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--host", default="192.168.10.1")
+    ap.add_argument("--mqtt-port", type=int, default=1883)
+    ap.add_argument("--duration", type=float, default=30)
+    ap.add_argument("--interval", type=float, default=0.05, help="seconds between latency probes")
+    ap.add_argument("--http-workers", type=int, default=4)
+    ap.add_argument("--slow-workers", type=int, default=2)
+    ap.add_argument("--byte-delay", type=float, default=0.03, help="seconds between slow POST bytes")
+    args = ap.parse_args()
+
+    stop = threading.Event()
+    counters = {"ok": 0, "other": 0, "slow": 0, "errors": 0}
+    threads = [threading.Thread(target=http_worker, args=(args.host, stop, counters), daemon=True)
+               for _ in range(args.http_workers)]
+    threads += [threading.Thread(target=slow_worker, args=(args.host, stop, counters, args.byte_delay), daemon=True)
+                for _ in range(args.slow_workers)]
+    for t in threads:
+        t.start()
+
+    try:
+        latencies, lost = measure(args.host, args.mqtt_port, args.duration, args.interval)
+    finally:
+        stop.set()
+        for t in threads:
+            t.join(timeout=2)
+
+    print("HTTP load: %d fast workers, %d slow workers" % (args.http_workers, args.slow_workers))
+    print("HTTP responses: %(ok)d ok, %(other)d other (e.g. 503), %(slow)d slow posts, %(errors)d errors" % counters)
+    if not latencies:
+        print("No MQTT messages were routed (%d lost)" % lost)
+        return
+    print("MQTT probes: %d routed, %d lost" % (len(latencies), lost))
+    print("MQTT latency ms: p50 %.1f  p95 %.1f  p99 %.1f  max %.1f  mean %.1f" % (
+        percentile(latencies, 50), percentile(latencies, 95), percentile(latencies, 99),
+        max(latencies), statistics.mean(latencies)))
+
+
+if __name__ == "__main__":
+    main()
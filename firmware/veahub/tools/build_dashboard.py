@@ -0,0 +1,81 @@
+"""Gzip the hub dashboard (firmware/veahub/web) into a PROGMEM header.
+
+Run after editing anything in web/ and commit the regenerated header:
+
+    python firmware/veahub/tools/build_dashboard.py
+"""
+import gzip
+import hashlib
+import os
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+WEB_DIR = os.path.join(HERE, "..", "web")
+OUT_PATH = os.path.join(HERE, "..", "dashboard_assets.h")
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".svg": "image/svg+xml",
+    ".json": "application/json",
+}
+
+
+def url_path(name):
+    return "/" if name == "index.html" else "/" + name
+
+
+def symbol(name):
+    return "ASSET_" + "".join(c.upper() if c.isalnum() else "_" for c in name) + "_GZ"
+
+
+def compress(raw):
+    # mtime=0 keeps the output (and so the ETag) identical across rebuilds
+    return gzip.compress(raw, compresslevel=9, mtime=0)
+
+
+def c_array(name, data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("  " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    return "static const uint8_t %s[] PROGMEM = {\n%s\n};\n" % (name, "\n".join(lines))
+
+
+def main():
+    names = sorted(n for n in os.listdir(WEB_DIR) if os.path.splitext(n)[1] in CONTENT_TYPES)
+
+    arrays = []
+    entries = []
+    raw_total = 0
+    gz_total = 0
+    for name in names:
+        with open(os.path.join(WEB_DIR, name), "rb") as f:
+            raw = f.read()
+        gz = compress(raw)
+        etag = hashlib.sha256(gz).hexdigest()[:16]
+        raw_total += len(raw)
+        gz_total += len(gz)
+
+        arrays.append(c_array(symbol(name), gz))
+        entries.append('  { "%s", "%s", "\\"%s\\"", %s, sizeof(%s) },  // %d -> %d bytes' % (
+            url_path(name), CONTENT_TYPES[os.path.splitext(name)[1]], etag,
+            symbol(name), symbol(name), len(raw), len(gz)))
+        print("%-12s %6d -> %5d bytes  etag %s" % (name, len(raw), len(gz), etag))
+
+    with open(OUT_PATH, "w", newline="\n") as out:
+        out.write("// Generated by tools/build_dashboard.py from web/ - do not edit.\n")
+        out.write("#pragma once\n#include <Arduino.h>\n\n")
+        out.write("struct DashboardAsset {\n")
+        out.write("  const char* path;\n  const char* contentType;\n  const char* etag;\n")
+        out.write("  const uint8_t* data;  // gzip\n  size_t length;\n};\n\n")
+        out.write("\n".join(arrays))
+        out.write("\nstatic const DashboardAsset DASHBOARD_ASSETS[] = {\n")
+        out.write("\n".join(entries))
+        out.write("\n};\n")
+        out.write("static const size_t DASHBOARD_ASSET_COUNT = sizeof(DASHBOARD_ASSETS) / sizeof(DASHBOARD_ASSETS[0]);\n")
+
+    print("total        %6d -> %5d bytes" % (raw_total, gz_total))
+
+
+if __name__ == "__main__":
+    main()
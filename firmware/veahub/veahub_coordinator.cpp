@@ -7,16 +7,37 @@
 // - Local MQTT Broker (lightweight)
 // - Device coordination
 // - Basic local automations
+// - Windowed rule conditions: avg/min/max(field, 5m), rate(field)
+// - Cross-device AND/OR conditions over a latest-value state cache
+// - Device registry: presence, slot, message rate and firmware per device
+// - Home and per-room aggregates on vealive/hub/summary and as rule pseudo-devices
+// - Rule backtesting over up to 24 h of telemetry history (1 h without PSRAM)
+// - Per-device history tiers (2 s raw, 1 min, 1 h) with /api/history range queries
+// - Compressed 1-minute archive on LittleFS with indexed /api/archive range reads
+// - Chunked page rendering from flash fragments (constant heap per request)
+// - Gzipped dashboard bundle with ETag revalidation (see tools/build_dashboard.py)
+// - Streamed JSON API: /api/stats, /api/rules, /api/devices, /api/state
+// - Live /events stream (SSE) with MQTT-style topic filters
+// - Prometheus /metrics for broker, rules, HTTP, loop time and heap
+// - Optional store-and-forward bridge to the cloud broker (AP+STA, LittleFS spool)
+// - Non-blocking HTTP server (requests parsed incrementally across loop passes)
 // - Web interface for configuration
 // -------------------------------------------------------------
 
 #include <WiFi.h>
-#include <WebServer.h>
 #include <DNSServer.h>
 #include <Preferences.h>
 #include <ArduinoJson.h>
 #include <PubSubClient.h>
 #include <ESPmDNS.h>
+#include <LittleFS.h>
+#include <time.h>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <lwip/sockets.h>
+#include "dashboard_assets.h"   // Generated by tools/build_dashboard.py
 
 // -------------------------------------------------------------
 // Configuration
@@ -34,10 +55,204 @@ static const int MQTT_PORT = 1883;
 static const int MAX_CLIENTS = 10;
 static const int MAX_SUBSCRIPTIONS = 50;
 
+// HTTP Configuration
+static const int HTTP_PORT = 80;
+static const int MAX_HTTP_CONNECTIONS = 4;
+static const size_t HTTP_MAX_REQUEST = 2048;         // Request line + headers + body
+static const size_t HTTP_READ_CHUNK = 512;           // Bytes read per connection per loop
+static const uint32_t HTTP_REQUEST_TIMEOUT_MS = 5000;
+static const size_t HTTP_MAX_QUEUED = 16384;         // Unsent response bytes held per connection
+static const size_t HTTP_RESUME_BELOW = 2048;        // A streamed body is resumed once the queue drains below this
+static const uint8_t HTTP_FLASH_RUNS = 4;            // Flash fragments queued by address per connection
+static const uint32_t HTTP_WRITE_TIMEOUT_MS = 10000; // Response abandoned after this long without progress
+
+// -------------------------------------------------------------
+// HTTP Server
+// -------------------------------------------------------------
+// Non-blocking replacement for WebServer with the same handler-facing API.
+// Each connection slot accumulates its request a little per loop() pass and
+// is only dispatched once complete, so a slow upload never stalls the broker.
+// Responses are queued on the connection and written with non-blocking
+// sends as the socket drains, so a slow reader doesn't stall it either.
+// Static assets and page fragments in flash are queued by address between
+// the generated bytes and sent straight from flash. A handler whose body can grow
+// with rules, devices or history writes the head and hands the rest to
+// stream(): the producer is called again from the poll loop each time the
+// queue drains below HTTP_RESUME_BELOW, so nothing waits on the socket and a
+// response never holds more than a part's worth of queued bytes. A handler
+// that queues more than HTTP_MAX_QUEUED in one go loses its response.
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_DELETE, HTTP_OPTIONS };
+static const size_t CONTENT_LENGTH_UNKNOWN = (size_t)-1;
+
+class ChunkWriter;
+typedef std::function<bool(ChunkWriter&)> BodyProducer;   // Writes the next part; false once done
+
+// A flash fragment, sent once out has gone up to at
+struct FlashRun {
+  size_t at;
+  const uint8_t* data;
+  size_t left;
+};
+
+struct HttpConnection {
+  bool active = false;
+  WiFiClient client;
+  String request;            // Raw bytes received so far
+  int headerEnd = -1;        // Offset of the body, once "\r\n\r\n" has arrived
+  size_t contentLength = 0;
+  uint32_t started = 0;
+
+  // Response, once dispatched
+  bool responding = false;
+  bool failed = false;                  // Socket error or reader too slow
+  bool chunked = false;                 // Body open as Transfer-Encoding: chunked
+  BodyProducer producer;                // Rest of a streamed body
+  String out;                           // Queued head and generated body
+  size_t outPos = 0;                    // Bytes of out already sent
+  FlashRun flash[HTTP_FLASH_RUNS];      // Oldest first
+  uint8_t flashRuns = 0;
+  uint32_t lastWrite = 0;
+};
+
+class HubHttpServer {
+public:
+  typedef std::function<void(void)> Handler;
+
+  explicit HubHttpServer(uint16_t port) : server(port) {}
+
+  void on(const char* uri, Handler handler) { on(uri, HTTP_ANY, handler); }
+  void on(const char* uri, HTTPMethod method, Handler handler) { routes.push_back({ uri, method, handler }); }
+  void collectHeaders(const char* keys[], size_t count);
+  void begin() { server.begin(); }
+  void handleClient();
+
+  // Request, valid inside a handler
+  const String& uri() const { return path; }
+  HTTPMethod method() const { return requestMethod; }
+  bool hasArg(const String& name) const;
+  String arg(const String& name) const;
+  String header(const String& name) const;
+  WiFiClient& client();     // Hands the socket to the caller; it is not closed after the handler
+
+  // Response
+  void sendHeader(const String& name, const String& value);
+  void setContentLength(size_t length) { responseLength = length; }
+  void send(int code, const char* contentType = nullptr, const String& content = String());
+  void send_P(int code, PGM_P contentType, PGM_P content, size_t length);
+  void sendContent(const String& content) { sendContent(content.c_str(), content.length()); }
+  void sendContent(const char* content, size_t length) { sendBody(content, length, false); }
+  void sendContent_P(PGM_P content) { sendBody(content, strlen_P(content), true); }
+  void stream(BodyProducer producer);   // After a chunked head; the handler returns right away
+
+  bool connectionActive(int slot) const { return connections[slot].active; }
+
+  uint32_t requestCount = 0;
+  uint32_t rejectedCount = 0;     // Refused for lack of a connection slot
+  uint32_t timeoutCount = 0;
+  uint32_t abandonedCount = 0;    // Responses dropped for a slow or dead reader
+
+private:
+  struct Route {
+    String uri;
+    HTTPMethod method;
+    Handler handler;
+  };
+  typedef std::pair<String, String> Pair;
+
+  void accept();
+  void poll(HttpConnection& conn);
+  void dispatch(HttpConnection& conn);
+  bool parseRequest(HttpConnection& conn);
+  void parseArgs(const String& encoded);
+  void sendHead(int code, const char* contentType, size_t length);
+  void reply(HttpConnection& conn, int code, const char* message);
+  void queue(const char* data, size_t length);
+  void queueFlash(PGM_P data, size_t length);
+  void sendBody(const char* content, size_t length, bool fromFlash);
+  void resume(HttpConnection& conn);
+  void writePending(HttpConnection& conn);
+  void flushResponse(HttpConnection& conn);
+  void close(HttpConnection& conn);
+
+  WiFiServer server;
+  std::vector<Route> routes;
+  std::vector<String> headerKeys;
+  HttpConnection connections[MAX_HTTP_CONNECTIONS];
+
+  // Current request
+  HttpConnection* current = nullptr;
+  HTTPMethod requestMethod = HTTP_ANY;
+  String path;
+  std::vector<Pair> args;
+  std::vector<Pair> headers;
+  String responseHeaders;
+  size_t responseLength = 0;
+  bool headSent = false;
+  bool detached = false;
+};
+
+// Buffers page output and flushes it as HTTP chunks, so rendering a page
+// costs one fixed buffer no matter how many rules or devices it lists.
+class ChunkWriter : public Print {
+public:
+  explicit ChunkWriter(HubHttpServer& server) : server(server) {}
+  ~ChunkWriter() { flush(); }   // The server closes a body left open
+
+  void begin(int code, const char* contentType) {
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(code, contentType, "");
+  }
+
+  using Print::write;
+  size_t write(uint8_t c) override {
+    if (len == sizeof(buf)) flush();
+    buf[len++] = c;
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t size) override {
+    size_t remaining = size;
+    while (remaining > 0) {
+      if (len == sizeof(buf)) flush();
+      size_t n = min(remaining, sizeof(buf) - len);
+      memcpy(buf + len, data, n);
+      len += n;
+      data += n;
+      remaining -= n;
+    }
+    return size;
+  }
+
+  // Static fragments are queued by address and sent straight from flash
+  void printP(PGM_P fragment) {
+    flush();
+    server.sendContent_P(fragment);
+  }
+
+  void flush() override {
+    if (len == 0) return;
+    server.sendContent(buf, len);
+    len = 0;
+  }
+
+  void end() {
+    if (ended) return;
+    flush();
+    server.sendContent("");  // Terminating zero-length chunk
+    ended = true;
+  }
+
+private:
+  HubHttpServer& server;
+  char buf[512];
+  size_t len = 0;
+  bool ended = false;
+};
+
 // -------------------------------------------------------------
 // Objects
 // -------------------------------------------------------------
-WebServer webServer(80);
+HubHttpServer webServer(HTTP_PORT);
 DNSServer dnsServer;
 Preferences prefs;
 
@@ -45,6 +260,427 @@ WiFiServer mqttServer(MQTT_PORT);
 WiFiClient mqttClients[MAX_CLIENTS];
 bool clientConnected[MAX_CLIENTS];
 
+// Event Stream
+// Every routed message is encoded once as an SSE frame into a shared ring;
+// each /events listener only keeps a cursor into it. A listener that falls
+// more than EVENT_BACKLOG frames behind skips ahead (drop-oldest).
+static const int MAX_EVENT_LISTENERS = 4;
+static const int MAX_EVENT_FILTERS = 4;
+static const uint32_t EVENT_RING_SIZE = 64;
+static const uint32_t EVENT_BACKLOG = 32;          // Per-listener bound, < EVENT_RING_SIZE
+static const uint32_t EVENT_HEARTBEAT_MS = 15000;
+
+struct StreamEvent {
+  String topic;
+  String frame;          // "id: N\ndata: {...}\n\n"
+};
+
+struct EventListener {
+  bool active = false;
+  WiFiClient client;
+  String filters[MAX_EVENT_FILTERS];
+  uint8_t filterCount = 0;
+  uint32_t cursor = 0;   // Sequence number of the next frame to send
+  size_t sent = 0;       // Bytes of the current frame already written
+  uint32_t lastWrite = 0;
+  uint32_t dropped = 0;
+};
+
+// Metrics
+// Bumped with relaxed atomics on the broker path and only read when /metrics
+// renders, so counting never takes a lock.
+static const int LOOP_BUCKET_COUNT = 8;
+static const uint32_t LOOP_BUCKET_US[LOOP_BUCKET_COUNT] = { 100, 250, 500, 1000, 2500, 5000, 10000, 50000 };
+
+struct ClientMetrics {
+  std::atomic<uint32_t> messagesIn{0};
+  std::atomic<uint32_t> messagesOut{0};
+  std::atomic<uint32_t> bytesIn{0};
+  std::atomic<uint32_t> bytesOut{0};
+  std::atomic<uint32_t> drops{0};         // Forwards the socket refused
+};
+
+struct HubMetrics {
+  ClientMetrics clients[MAX_CLIENTS];
+  std::atomic<uint32_t> rulesFired{0};
+  std::atomic<uint32_t> jsonErrors{0};
+  std::atomic<uint32_t> loopBuckets[LOOP_BUCKET_COUNT + 1] = {};   // Last bucket is +Inf
+  std::atomic<uint32_t> loopCount{0};
+  std::atomic<uint32_t> loopSumUs{0};
+  std::atomic<uint32_t> loopMaxUs{0};
+};
+
+HubMetrics metrics;
+
+static inline void bump(std::atomic<uint32_t>& counter, uint32_t n = 1) {
+  counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+StreamEvent eventRing[EVENT_RING_SIZE];
+uint32_t eventHead = 0;  // Sequence number of the next frame to encode
+EventListener eventListeners[MAX_EVENT_LISTENERS];
+uint32_t eventDrops = 0;
+
+// Cloud Bridge
+// Optional uplink: the hub joins the home network as a station (AP+STA) and
+// republishes selected topics to the cloud broker. While the cloud is
+// unreachable, messages are staged in RAM and spooled to LittleFS as
+// LZ-compressed, timestamped batches, then drained oldest-first through a
+// token bucket once it is back, alongside live traffic.
+static const char* CLOUD_BROKER_HOST = "63.34.243.171";   // IP literal: connected without DNS
+static const int CLOUD_BROKER_PORT = 1883;
+static const char* BRIDGE_DEFAULT_TOPICS = "vealive/+/+/telemetry,vealive/+/+/status,vealive/hub/summary";
+static const int MAX_BRIDGE_FILTERS = 4;
+static const char* SPOOL_DIR = "/spool";
+static const size_t SPOOL_BATCH_BYTES = 4096;           // Raw records per batch
+static const uint32_t SPOOL_BATCH_MAX_AGE_MS = 30000;
+static const size_t SPOOL_MAX_BYTES = 256 * 1024;      // Oldest batches are dropped beyond this
+static const float BRIDGE_DRAIN_PER_SEC = 10;           // Backlog messages per second
+static const float BRIDGE_DRAIN_BURST = 20;
+static const uint32_t BRIDGE_BACKOFF_MIN_MS = 1000;
+static const uint32_t BRIDGE_BACKOFF_MAX_MS = 60000;
+static const uint32_t BRIDGE_CONNECT_TIMEOUT_MS = 5000;   // TCP handshake, polled from loop()
+static const uint8_t BRIDGE_RECORD_ATTEMPTS = 3;          // Refusals while connected before a record is dropped
+
+struct BridgeConfig {
+  bool enabled = false;
+  String ssid;
+  String password;
+  String topics;
+  String filters[MAX_BRIDGE_FILTERS];
+  uint8_t filterCount = 0;
+};
+
+struct BridgeState {
+  bool fsReady = false;
+  bool ntpStarted = false;
+  uint32_t bootId = 0;
+
+  // Batch being filled while offline
+  uint8_t batch[SPOOL_BATCH_BYTES];
+  size_t batchLen = 0;
+  uint16_t batchRecords = 0;
+  uint32_t batchStarted = 0;
+
+  // Oldest spooled batch, decompressed, being replayed
+  uint8_t drain[SPOOL_BATCH_BYTES];
+  size_t drainLen = 0;
+  size_t drainPos = 0;
+  size_t drainFileSize = 0;
+  uint32_t drainBootId = 0;
+  uint32_t drainSeq = 0;       // Spool file the drain buffer came from
+  uint8_t drainAttempts = 0;   // Failed publishes of the current record
+  bool draining = false;
+
+  // Spool files are SPOOL_DIR/<seq>, oldestSeq .. nextSeq-1
+  uint32_t oldestSeq = 0;
+  uint32_t nextSeq = 0;
+  size_t spoolBytes = 0;
+
+  float tokens = BRIDGE_DRAIN_BURST;
+  uint32_t lastRefill = 0;
+  uint32_t backoffMs = BRIDGE_BACKOFF_MIN_MS;
+  uint32_t nextAttempt = 0;
+  int connectFd = -1;          // Non-blocking TCP connect in progress
+  uint32_t connectStarted = 0;
+
+  uint32_t forwarded = 0;
+  uint32_t spooled = 0;
+  uint32_t replayed = 0;
+  uint32_t dropped = 0;
+};
+
+BridgeConfig bridgeConfig;
+BridgeState bridge;
+WiFiClient cloudNet;
+PubSubClient cloud(cloudNet);
+
+// Device State Cache
+// Latest value of every numeric telemetry field, per device. Device keys come
+// from the topic ("vealive/smartmonitor/1/telemetry" -> "smartmonitor/1") and,
+// like field names, are interned to small IDs so lookups are plain array reads.
+// Device keys are found through an open-addressing hash table (FNV-1a, linear
+// probing); devices are never removed, so no tombstones are needed.
+static const int MAX_DEVICES = 32;
+static const int MAX_FIELDS = 32;       // Fits one uint32_t presence mask
+static const int MAX_KEY_LEN = 32;
+
+enum KnownField : uint8_t {
+  FIELD_TEMP, FIELD_HUM, FIELD_DUST, FIELD_MQ2, FIELD_ALERT_FLAGS, FIELD_RSSI, FIELD_UPTIME,
+  FIELD_ONLINE,            // Maintained by the hub from presence, not reported
+  KNOWN_FIELD_COUNT
+};
+static const char* KNOWN_FIELD_NAMES[KNOWN_FIELD_COUNT] = {
+  "temp", "hum", "dust", "mq2", "alertFlags", "rssi", "uptime", "online"
+};
+
+struct DeviceState {
+  char key[MAX_KEY_LEN];
+  float values[MAX_FIELDS];
+  uint32_t presentMask;    // Fields ever reported
+  uint32_t updatedMask;    // Fields carried by the most recent message
+  uint32_t lastSeen;
+};
+
+DeviceState deviceStates[MAX_DEVICES];
+uint8_t deviceCount = 0;
+char fieldNames[MAX_FIELDS][MAX_KEY_LEN];
+uint8_t fieldCount = 0;
+static const uint8_t NO_ID = 0xFF;
+
+// Device Registry
+// Presence and connection facts per device, indexed like deviceStates. Updated
+// on the routing path from stack buffers only (no allocation).
+static const int DEVICE_TABLE_SIZE = 64;             // Power of two, 2x MAX_DEVICES
+static const uint32_t PRESENCE_TIMEOUT_MS = 45000;   // AirGuard telemetry: 2 s, governed down to 15 s
+static const int MAX_FW_LEN = 16;
+
+enum DeviceCapability : uint8_t {
+  CAP_TELEMETRY  = 1 << 0,
+  CAP_STATUS     = 1 << 1,
+  CAP_THRESHOLDS = 1 << 2,
+};
+
+struct DeviceRecord {
+  uint8_t slot;            // Broker slot it last published from, NO_ID if none
+  bool online;
+  uint8_t caps;            // DeviceCapability bits, from the topics it publishes
+  uint16_t connects;       // Broker connections it has been seen on
+  uint32_t session;        // clientSession of the connection last seen on
+  uint32_t firstSeen;
+  uint32_t messages;
+  uint32_t lastMessage;
+  float rate;              // Messages per minute, smoothed
+  bool presencePending;    // Came back with a telemetry message; evaluated with its payload
+  char fw[MAX_FW_LEN];     // "fw" telemetry field, if the device sends one
+};
+
+uint8_t deviceTable[DEVICE_TABLE_SIZE];      // Device IDs, NO_ID = empty
+DeviceRecord deviceRecords[MAX_DEVICES];
+uint8_t slotDevice[MAX_CLIENTS];             // Device last seen on each broker slot
+uint32_t clientSession[MAX_CLIENTS];         // Bumped on every accept
+
+// User-chosen names for devices, e.g. "livingroom" -> "smartmonitor/1"
+struct DeviceAlias {
+  String name;
+  String deviceKey;
+  String room;             // Optional; devices sharing a room are aggregated together
+};
+
+std::vector<DeviceAlias> deviceAliases;
+
+// Telemetry History
+// Per-device ring buffers at three resolutions (2 s raw, 1 min, 1 h), each
+// bucket holding min/max/mean of every history field. Routed samples are folded
+// into each tier's open bucket, which is appended to the ring once its time
+// is up, whether or not the device reports again. Storage is allocated once per device on first report, from
+// PSRAM when present, and the device count is capped so total use is fixed.
+static const uint8_t HISTORY_FIELD_COUNT = FIELD_RSSI + 1;   // temp .. rssi
+static const int HISTORY_TIER_COUNT = 3;
+static const uint8_t HISTORY_DEVICES_PSRAM = 12;
+static const uint8_t HISTORY_DEVICES_HEAP = 4;
+static const int MAX_BACKTEST_TIMESTAMPS = 100;
+static const uint32_t MAX_BACKTEST_HOURS = 24;   // The 1-minute tier with PSRAM
+
+enum HistoryTierId { TIER_RAW, TIER_MINUTE, TIER_HOUR };
+
+struct HistoryTierConfig {
+  const char* name;
+  uint32_t stepSec;
+  uint16_t slotsPsram;
+  uint16_t slotsHeap;
+};
+
+static const HistoryTierConfig HISTORY_TIERS[HISTORY_TIER_COUNT] = {
+  { "raw", 2,    300,  60 },   // 10 min (2 min without PSRAM)
+  { "1m",  60,   1440, 60 },   // 24 h   (1 h)
+  { "1h",  3600, 336,  24 },   // 14 d   (24 h)
+};
+
+struct HistoryBucket {
+  float min, max, mean;        // NAN when the field had no samples
+};
+
+struct HistoryTier {
+  uint32_t* start = nullptr;          // Bucket start per slot, seconds since boot
+  HistoryBucket* buckets = nullptr;   // slots x HISTORY_FIELD_COUNT
+  uint16_t slots = 0;
+  uint16_t head = 0;                  // Slot of the oldest bucket
+  uint16_t count = 0;
+
+  // Bucket being filled
+  uint32_t openStart = 0;
+  float openMin[HISTORY_FIELD_COUNT];
+  float openMax[HISTORY_FIELD_COUNT];
+  float openSum[HISTORY_FIELD_COUNT];
+  uint16_t openCount[HISTORY_FIELD_COUNT];
+
+  // i-th oldest closed bucket
+  uint32_t rowStart(uint16_t i) const { return start[(head + i) % slots]; }
+  const HistoryBucket* row(uint16_t i) const { return &buckets[((head + i) % slots) * HISTORY_FIELD_COUNT]; }
+};
+
+struct DeviceHistory {
+  bool allocated = false;
+  HistoryTier tiers[HISTORY_TIER_COUNT];
+};
+
+DeviceHistory deviceHistory[MAX_DEVICES];
+uint8_t historyDevices = 0;
+uint8_t historyDeviceLimit = 0;
+
+// Telemetry Archive
+// Long-term copy of every 1-minute bucket mean on LittleFS, for weeks of history
+// beyond the RAM tiers. Records are packed into blocks with delta-of-delta
+// timestamps and zigzag varint value deltas (in hundredths) per device, so a
+// slowly moving field costs about a byte. Blocks are appended to segment files,
+// each with a sidecar index of block time ranges for range queries.
+static const char* ARCHIVE_DIR = "/archive";
+static const size_t ARCHIVE_BLOCK_BYTES = 1024;             // Encoded records per block
+static const uint32_t ARCHIVE_BLOCK_MAX_AGE_MS = 600000;    // Bounds what a power cut loses
+static const size_t ARCHIVE_SEGMENT_BYTES = 64 * 1024;
+static const size_t ARCHIVE_MAX_BYTES = 768 * 1024;         // Oldest segments are dropped beyond this
+static const int ARCHIVE_BLOCK_DEVICES = 16;
+static const float ARCHIVE_SCALE = 100;
+
+struct ArchiveIndexEntry {
+  uint32_t firstTs;        // Earliest and latest record in the block
+  uint32_t lastTs;
+  uint32_t bootId;
+  uint32_t offset;         // Of the block in its segment file
+  uint16_t length;
+  uint8_t flags;           // RECORD_EPOCH
+  uint8_t reserved;
+};
+
+// Encoder state of one device within the open block
+struct ArchiveSeries {
+  uint8_t keyIndex;        // Position in the block's key table, NO_ID if not in it
+  uint32_t lastTs;
+  int32_t lastDelta;
+  int32_t last[HISTORY_FIELD_COUNT];
+};
+
+struct ArchiveState {
+  bool ready = false;
+
+  // Block being filled
+  uint8_t block[ARCHIVE_BLOCK_BYTES];
+  size_t blockLen = 0;
+  uint16_t blockRecords = 0;
+  uint8_t blockFlags = 0;
+  uint32_t blockBaseTs = 0;        // Timestamps are coded relative to this
+  uint32_t blockMinTs = 0;
+  uint32_t blockMaxTs = 0;
+  uint32_t blockStarted = 0;
+  uint8_t blockDevices[ARCHIVE_BLOCK_DEVICES];
+  uint8_t blockDeviceCount = 0;
+  ArchiveSeries series[MAX_DEVICES];
+
+  // Segments are ARCHIVE_DIR/<seq> plus <seq>.idx, oldestSeq .. nextSeq-1
+  uint32_t oldestSeq = 0;
+  uint32_t nextSeq = 0;
+  size_t segmentBytes = 0;         // Of the newest segment
+  size_t bytes = 0;
+
+  uint32_t records = 0;
+  uint32_t rawBytes = 0;           // The same records as a 4-byte timestamp plus floats
+  uint32_t blocksWritten = 0;
+};
+
+ArchiveState archive;
+
+// Home Aggregates
+// Mean/min/max/count of each history field over online devices, for the whole
+// home and per room (an alias's room, else the alias name), with alert flags
+// OR-ed instead of averaged. Published on SUMMARY_TOPIC at a fixed low rate and
+// mirrored into the state cache as pseudo-devices "home" and "room/<name>", so
+// rules can use "home.temp > 28" or "max(room/kitchen.mq2, 5m) > 400".
+static const char* SUMMARY_TOPIC = "vealive/hub/summary";
+static const uint32_t SUMMARY_INTERVAL_MS = 10000;
+static const uint32_t SUMMARY_HEARTBEAT_MS = 60000;   // Republished unchanged this often
+static const int MAX_ROOMS = 8;
+
+struct FieldAggregate {
+  float sum, min, max;
+  uint16_t count;
+};
+
+struct AreaAggregate {
+  String name;
+  uint8_t device;          // Pseudo-device in the state cache
+  uint8_t members;
+  uint32_t alertFlags;
+  FieldAggregate fields[HISTORY_FIELD_COUNT];
+};
+
+AreaAggregate homeAggregate;
+AreaAggregate roomAggregates[MAX_ROOMS];
+uint8_t roomCount = 0;
+uint8_t spareRoomDevices[MAX_ROOMS];   // Pseudo-device IDs of freed rooms, reused first
+uint8_t spareRoomCount = 0;
+bool roomTableFullLogged = false;
+uint32_t aggregateDeviceMask = 0;    // Pseudo-device IDs, never aggregated themselves
+bool summaryDirty = false;           // Telemetry or presence changed since the last summary
+
+// Rule Conditions
+// Instant:   "temp > 30", "livingroom.temp > 28.5"
+// Windowed:  "avg(temp, 5m) > 28", "max(mq2, 30s) > 200", "rate(hum) > 5/min"
+// Compound:  "livingroom.temp > 28 AND (bedroom.hum > 60 OR max(mq2, 30s) > 200)"
+// Unqualified fields refer to the rule's source device.
+static const uint16_t WINDOW_CAPACITY = 160;
+static const uint32_t WINDOW_CADENCE_MS = 2000;       // Fastest telemetry rate
+static const uint32_t WINDOW_MAX_MS = WINDOW_CAPACITY * WINDOW_CADENCE_MS;  // 5 min 20 s
+static const uint32_t DEFAULT_RATE_WINDOW_MS = 60000;
+
+enum ConditionAgg : uint8_t { AGG_NONE, AGG_AVG, AGG_MIN, AGG_MAX, AGG_RATE };
+enum ConditionOp  : uint8_t { OP_GT, OP_LT, OP_EQ, OP_GE, OP_LE };
+enum ConditionNodeType : uint8_t { NODE_CMP, NODE_AND, NODE_OR };
+
+struct ConditionNode {
+  ConditionNodeType type = NODE_CMP;
+  // NODE_CMP
+  ConditionAgg agg = AGG_NONE;
+  ConditionOp op = OP_GT;
+  uint8_t device = NO_ID;
+  uint8_t field = NO_ID;
+  uint8_t window = NO_ID;  // Index into AutomationRule::windows
+  uint32_t windowMs = 0;   // Aggregation window (windowed comparisons only)
+  float value = 0;         // Threshold (rates are normalised to units/second)
+  // NODE_AND / NODE_OR
+  uint8_t lhs = 0, rhs = 0;
+};
+
+// Sliding time window over one field. Samples live in a fixed ring with a
+// running sum; min/max come from monotonic deques of ring indices, so every
+// push and eviction is amortised O(1) and nothing is rescanned.
+struct WindowAggregate {
+  uint32_t windowMs;
+  uint32_t ts[WINDOW_CAPACITY];
+  float values[WINDOW_CAPACITY];
+  uint16_t head = 0;       // Ring index of the oldest sample
+  uint16_t count = 0;
+  double sum = 0;
+
+  uint16_t minDeque[WINDOW_CAPACITY];   // Ring indices, values increasing
+  uint16_t maxDeque[WINDOW_CAPACITY];   // Ring indices, values decreasing
+  uint16_t minHead = 0, minCount = 0;
+  uint16_t maxHead = 0, maxCount = 0;
+
+  explicit WindowAggregate(uint32_t window) : windowMs(window) {}
+
+  void push(uint32_t now, float v);
+  void expire(uint32_t now);
+  bool ready() const { return count > 0; }
+  float avg() const { return (float)(sum / count); }
+  float minValue() const { return values[minDeque[minHead]]; }
+  float maxValue() const { return values[maxDeque[maxHead]]; }
+  float ratePerSecond() const;
+
+ private:
+  void evictOldest();
+};
+
 // Automation Rules
 struct AutomationRule {
   bool enabled;
@@ -52,6 +688,13 @@ struct AutomationRule {
   String condition;        // e.g., "temp > 30"
   String targetTopic;      // e.g., "vealive/smartplug/2/command/state"
   String targetPayload;    // e.g., "{\"state\":\"OFF\"}"
+
+  // Compiled form, built once when the rule is added
+  std::vector<ConditionNode> nodes;
+  uint8_t root = 0;
+  uint32_t deviceMask = 0;                              // Devices whose updates re-evaluate the rule
+  bool unresolved = false;                              // Names a device or field not seen yet
+  std::vector<std::unique_ptr<WindowAggregate>> windows; // One per windowed comparison
 };
 
 std::vector<AutomationRule> automationRules;
@@ -61,14 +704,54 @@ std::vector<AutomationRule> automationRules;
 // -------------------------------------------------------------
 void startAccessPoint();
 void handleMQTT();
+void publishEvent(const String& topic, const String& payload);
+void pumpEventStreams();
 void processMQTTMessage(const String& topic, const String& payload);
-void evaluateAutomations(const String& topic, const String& payload);
+void initDeviceState();
+void noteDeviceActivity(int slot, const char* topic, const char* payload);
+void evaluatePendingPresence(const String& topic);
+void markSlotOffline(int slot);
+void sweepPresence();
+void serviceSummary();
+void initHistory();
+void recordHistory(uint8_t device);
+void sweepHistory();
+void initArchive();
+void serviceArchive();
+void archiveBucket(uint8_t device, const HistoryTier& tier);
+void updateDeviceState(const String& topic, JsonDocument& doc);
+void evaluateAutomations(uint8_t device);
+bool compileRule(AutomationRule& rule);
 void setupWebInterface();
-void handleRoot();
+void serveAsset(const DashboardAsset& asset);
+void handleApiStats();
+void handleApiRules();
+void handleApiDevices();
+void handleApiState();
+void handleApiHistory();
+void handleApiArchive();
+void handleEvents();
+void handleMetrics();
+void initBridge();
+void applyBridgeConfig();
+void serviceBridge();
+void bridgeForward(const String& topic, const String& payload);
+void handleApiBridge();
+void handleBridge();
+void loadBridgeConfig();
+void saveBridgeConfig();
+void observeLoopTime(uint32_t us);
 void handleAutomations();
 void handleAddRule();
 void handleDeleteRule();
+void handleAddAlias();
+void handleBacktest();
+void handleDeleteAlias();
 void handleStats();
+void loadDeviceAliases();
+void saveDeviceAliases();
+void recompileRules();
+void pruneRooms();
 
 // -------------------------------------------------------------
 // Setup
@@ -82,10 +765,15 @@ void setup() {
 
   // Initialize preferences
   prefs.begin("veahub", false);
+  initDeviceState();
+  initHistory();
+  loadDeviceAliases();
   loadAutomationRules();
 
   // Start Access Point
   startAccessPoint();
+  initBridge();
+  initArchive();
 
   // Start MQTT Server
   mqttServer.begin();
@@ -102,7 +790,7 @@ void setup() {
   // Start mDNS responder
   if (MDNS.begin("veahub")) {
     Serial.println("[mDNS] Responder started: veahub.local");
-    MDNS.addService("http", "tcp", 80);
+    MDNS.addService("http", "tcp", HTTP_PORT);
     MDNS.addService("mqtt", "tcp", MQTT_PORT);
   }
 
@@ -132,6 +820,16 @@ void startAccessPoint() {
 // -------------------------------------------------------------
 // MQTT Server (Simplified)
 // -------------------------------------------------------------
+static void countForward(int client, size_t written) {
+  ClientMetrics& m = metrics.clients[client];
+  if (written == 0) {
+    bump(m.drops);
+    return;
+  }
+  bump(m.messagesOut);
+  bump(m.bytesOut, written);
+}
+
 void handleMQTT() {
   // Accept new clients
   if (mqttServer.hasClient()) {
@@ -142,6 +840,7 @@ void handleMQTT() {
         }
         mqttClients[i] = mqttServer.available();
         clientConnected[i] = true;
+        clientSession[i]++;
         Serial.printf("[MQTT] Client %d connected\n", i);
         break;
       }
@@ -153,6 +852,8 @@ void handleMQTT() {
     if (clientConnected[i] && mqttClients[i].connected()) {
       if (mqttClients[i].available()) {
         String data = mqttClients[i].readStringUntil('\n');
+        bump(metrics.clients[i].messagesIn);
+        bump(metrics.clients[i].bytesIn, data.length() + 1);
         
         // Simple MQTT message parsing
         // Format: TOPIC|PAYLOAD
@@ -166,10 +867,14 @@ void handleMQTT() {
           // Forward to all other clients
           for (int j = 0; j < MAX_CLIENTS; j++) {
             if (j != i && clientConnected[j] && mqttClients[j].connected()) {
-              mqttClients[j].println(data);
+              countForward(j, mqttClients[j].println(data));
             }
           }
           
+          noteDeviceActivity(i, topic.c_str(), payload.c_str());
+          publishEvent(topic, payload);
+          bridgeForward(topic, payload);
+
           // Process message for automations
           processMQTTMessage(topic, payload);
         }
@@ -177,6 +882,7 @@ void handleMQTT() {
     } else if (clientConnected[i]) {
       clientConnected[i] = false;
       Serial.printf("[MQTT] Client %d disconnected\n", i);
+      markSlotOffline(i);
     }
   }
 }
@@ -191,297 +897,3441 @@ void processMQTTMessage(const String& topic, const String& payload) {
     DeserializationError err = deserializeJson(doc, payload);
     
     if (!err) {
-      // Extract sensor values
-      int temp = doc["temp"] | 0;
-      int hum = doc["hum"] | 0;
-      int dust = doc["dust"] | 0;
-      int mq2 = doc["mq2"] | 0;
-      
-      // Evaluate automation rules
-      evaluateAutomations(topic, payload);
+      // Cache fields and evaluate automation rules
+      updateDeviceState(topic, doc);
+    } else {
+      bump(metrics.jsonErrors);
+      evaluatePendingPresence(topic);
     }
   }
 }
 
 // -------------------------------------------------------------
-// Automation Rule Evaluation
+// Device State Cache
 // -------------------------------------------------------------
-void evaluateAutomations(const String& topic, const String& payload) {
-  StaticJsonDocument<512> doc;
-  DeserializationError err = deserializeJson(doc, payload);
-  if (err) return;
+// "vealive/smartmonitor/1/telemetry" -> "smartmonitor/1"
+String deviceKeyFromTopic(const String& topic) {
+  int start = topic.indexOf('/') + 1;
+  int end = topic.lastIndexOf('/');
+  if (end <= start) return topic;
+  return topic.substring(start, end);
+}
 
-  for (const auto& rule : automationRules) {
-    if (!rule.enabled) continue;
-    
-    // Check if topic matches
-    if (topic != rule.sourceTopic) continue;
-    
-    // Evaluate condition (simple parser)
-    bool triggered = false;
-    
-    // Example: "temp > 30"
-    int spacePos = rule.condition.indexOf(' ');
-    if (spacePos > 0) {
-      String field = rule.condition.substring(0, spacePos);
-      String rest = rule.condition.substring(spacePos + 1);
-      
-      int opPos = rest.indexOf(' ');
-      if (opPos > 0) {
-        String op = rest.substring(0, opPos);
-        int value = rest.substring(opPos + 1).toInt();
-        
-        int fieldValue = doc[field] | 0;
-        
-        if (op == ">") triggered = (fieldValue > value);
-        else if (op == "<") triggered = (fieldValue < value);
-        else if (op == "==") triggered = (fieldValue == value);
-        else if (op == ">=") triggered = (fieldValue >= value);
-        else if (op == "<=") triggered = (fieldValue <= value);
-      }
-    }
-    
-    if (triggered) {
-      Serial.printf("[AUTO] Rule triggered: %s\n", rule.condition.c_str());
-      Serial.printf("[AUTO] Publishing to: %s\n", rule.targetTopic.c_str());
-      
-      // Publish to all connected clients
-      String message = rule.targetTopic + "|" + rule.targetPayload;
-      for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clientConnected[i] && mqttClients[i].connected()) {
-          mqttClients[i].println(message);
-        }
-      }
-    }
+// Device-originated topics are exactly "vealive/<type>/<id>/<kind>";
+// commands ("vealive/<type>/<id>/command/...") and other shapes yield nullptr
+static const char* deviceTopicKind(const char* topic) {
+  if (strncmp(topic, "vealive/", 8) != 0) return nullptr;
+  const char* type = topic + 8;
+  const char* id = strchr(type, '/');
+  if (!id || id == type) return nullptr;
+  id++;
+  const char* kind = strchr(id, '/');
+  if (!kind || kind == id) return nullptr;
+  kind++;
+  if (*kind == '\0' || strchr(kind, '/')) return nullptr;
+  return kind;
+}
+
+static uint32_t fnv1a(const char* s) {
+  uint32_t h = 2166136261u;
+  while (*s) {
+    h ^= (uint8_t)*s++;
+    h *= 16777619u;
   }
+  return h;
 }
 
-// -------------------------------------------------------------
-// Web Interface
-// -------------------------------------------------------------
-void setupWebInterface() {
-  webServer.on("/", handleRoot);
-  webServer.on("/automations", handleAutomations);
-  webServer.on("/add-rule", HTTP_POST, handleAddRule);
-  webServer.on("/delete-rule", HTTP_POST, handleDeleteRule);
-  webServer.on("/stats", handleStats);
-  
-  webServer.begin();
-  Serial.println("[WEB] Server started on port 80");
+// Table position holding key, or the empty position where it would go
+static int deviceTablePosition(const char* key) {
+  int pos = fnv1a(key) & (DEVICE_TABLE_SIZE - 1);
+  for (int probe = 0; probe < DEVICE_TABLE_SIZE; probe++) {
+    uint8_t id = deviceTable[pos];
+    if (id == NO_ID || strcmp(deviceStates[id].key, key) == 0) return pos;
+    pos = (pos + 1) & (DEVICE_TABLE_SIZE - 1);
+  }
+  return -1;
 }
 
-void handleRoot() {
-  String html = R"(
-<!DOCTYPE html>
-<html>
-<head>
-  <meta charset="utf-8">
-  <meta name="viewport" content="width=device-width,initial-scale=1">
-  <title>VeaHub Coordinator</title>
-  <style>
-    * { box-sizing: border-box; margin: 0; padding: 0; }
-    body { font-family: system-ui; background: #1a1a2e; color: #eee; padding: 20px; }
-    .container { max-width: 800px; margin: 0 auto; }
-    h1 { color: #00d4ff; margin-bottom: 10px; }
-    .status { background: #16213e; padding: 15px; border-radius: 8px; margin-bottom: 20px; }
-    .status-item { display: flex; justify-content: space-between; padding: 8px 0; border-bottom: 1px solid #0f3460; }
-    .status-item:last-child { border-bottom: none; }
-    .label { color: #aaa; }
-    .value { color: #00d4ff; font-weight: bold; }
-    .section { background: #16213e; padding: 20px; border-radius: 8px; margin-bottom: 20px; }
-    .section h2 { color: #00d4ff; margin-bottom: 15px; }
-    .btn { background: #00d4ff; color: #1a1a2e; border: none; padding: 10px 20px; border-radius: 5px; cursor: pointer; font-weight: bold; }
-    .btn:hover { background: #00b8d4; }
-    a { color: #00d4ff; text-decoration: none; }
-    a:hover { text-decoration: underline; }
-  </style>
-</head>
-<body>
-  <div class="container">
-    <h1>🏠 VeaHub Coordinator</h1>
-    <p style="color:#aaa;margin-bottom:20px;">Local mesh network controller for VeaHome devices</p>
-    
-    <div class="status">
-      <h2 style="margin-bottom:15px;">System Status</h2>
-      <div class="status-item">
-        <span class="label">Mode</span>
-        <span class="value">MESH AP</span>
-      </div>
-      <div class="status-item">
-        <span class="label">SSID</span>
-        <span class="value">)" + String(AP_SSID) + R"(</span>
-      </div>
-      <div class="status-item">
-        <span class="label">IP Address</span>
-        <span class="value">)" + apIP.toString() + R"(</span>
-      </div>
-      <div class="status-item">
-        <span class="label">MQTT Broker</span>
-        <span class="value">)" + apIP.toString() + ":" + String(MQTT_PORT) + R"(</span>
-      </div>
-      <div class="status-item">
-        <span class="label">Uptime</span>
-        <span class="value">)" + String(millis() / 1000) + R"( seconds</span>
-      </div>
-    </div>
-    
-    <div class="section">
-      <h2>Quick Links</h2>
-      <p><a href="/automations">📋 Manage Automations</a></p>
-      <p><a href="/stats">📊 Device Statistics</a></p>
-    </div>
-    
-    <div class="section">
-      <h2>Configuration</h2>
-      <p style="color:#aaa;margin-bottom:10px;">Connect your devices to this network:</p>
-      <p><strong>SSID:</strong> )" + String(AP_SSID) + R"(</p>
-      <p><strong>Password:</strong> )" + String(AP_PASSWORD) + R"(</p>
-      <p style="color:#aaa;margin-top:10px;">MQTT Broker: )" + apIP.toString() + ":" + String(MQTT_PORT) + R"(</p>
-    </div>
-  </div>
-</body>
-</html>
-)";
-  webServer.send(200, "text/html", html);
+uint8_t findDevice(const char* key) {
+  int pos = deviceTablePosition(key);
+  return pos < 0 ? NO_ID : deviceTable[pos];
 }
 
-void handleAutomations() {
-  String html = R"(
-<!DOCTYPE html>
-<html>
-<head>
-  <meta charset="utf-8">
-  <meta name="viewport" content="width=device-width,initial-scale=1">
-  <title>Automations - VeaHub</title>
-  <style>
-    * { box-sizing: border-box; margin: 0; padding: 0; }
-    body { font-family: system-ui; background: #1a1a2e; color: #eee; padding: 20px; }
-    .container { max-width: 800px; margin: 0 auto; }
-    h1 { color: #00d4ff; margin-bottom: 20px; }
-    .rule { background: #16213e; padding: 15px; border-radius: 8px; margin-bottom: 10px; }
-    .rule-header { display: flex; justify-content: space-between; align-items: center; margin-bottom: 10px; }
-    .rule-condition { color: #00d4ff; font-weight: bold; }
-    .rule-action { color: #aaa; font-size: 14px; }
-    .btn-delete { background: #ff4444; color: white; border: none; padding: 5px 15px; border-radius: 5px; cursor: pointer; }
-    .btn { background: #00d4ff; color: #1a1a2e; border: none; padding: 10px 20px; border-radius: 5px; cursor: pointer; font-weight: bold; margin-top: 10px; }
-    a { color: #00d4ff; text-decoration: none; }
-  </style>
-</head>
-<body>
-  <div class="container">
-    <h1>📋 Local Automations</h1>
-    <p style="margin-bottom:20px;"><a href="/">← Back to Dashboard</a></p>
-    
-)";
+// Set when a device or field is first interned; rules waiting on a name
+// are recompiled then (see resolvePendingRules)
+static bool registryGrew = false;
 
-  // List rules
-  for (size_t i = 0; i < automationRules.size(); i++) {
-    const auto& rule = automationRules[i];
-    html += "<div class='rule'>";
-    html += "<div class='rule-header'>";
-    html += "<div class='rule-condition'>" + rule.condition + "</div>";
-    html += "<form method='POST' action='/delete-rule' style='display:inline;'>";
-    html += "<input type='hidden' name='index' value='" + String(i) + "'>";
-    html += "<button type='submit' class='btn-delete'>Delete</button>";
-    html += "</form>";
-    html += "</div>";
-    html += "<div class='rule-action'>If " + rule.condition + " then publish to " + rule.targetTopic + "</div>";
-    html += "</div>";
-  }
-
-  html += R"(
-    <h2 style="color:#00d4ff;margin-top:30px;">Add New Rule</h2>
-    <form method="POST" action="/add-rule" style="background:#16213e;padding:20px;border-radius:8px;">
-      <p><label>Source Topic:<br><input type="text" name="source" style="width:100%;padding:8px;margin-top:5px;" placeholder="vealive/smartmonitor/1/telemetry"></label></p>
-      <p><label>Condition:<br><input type="text" name="condition" style="width:100%;padding:8px;margin-top:5px;" placeholder="temp > 30"></label></p>
-      <p><label>Target Topic:<br><input type="text" name="target" style="width:100%;padding:8px;margin-top:5px;" placeholder="vealive/smartplug/2/command/state"></label></p>
-      <p><label>Payload:<br><input type="text" name="payload" style="width:100%;padding:8px;margin-top:5px;" placeholder="{&quot;state&quot;:&quot;OFF&quot;}"></label></p>
-      <button type="submit" class="btn">Add Rule</button>
-    </form>
-  </div>
-</body>
-</html>
-)";
-  webServer.send(200, "text/html", html);
+static void resetDevice(uint8_t id, const char* key) {
+  DeviceState& d = deviceStates[id];
+  memset(&d, 0, sizeof(d));
+  strncpy(d.key, key, MAX_KEY_LEN - 1);
+
+  DeviceRecord& r = deviceRecords[id];
+  memset(&r, 0, sizeof(r));
+  r.slot = NO_ID;
+  r.firstSeen = millis();
 }
 
-void handleAddRule() {
-  AutomationRule rule;
-  rule.enabled = true;
-  rule.sourceTopic = webServer.arg("source");
-  rule.condition = webServer.arg("condition");
-  rule.targetTopic = webServer.arg("target");
-  rule.targetPayload = webServer.arg("payload");
-  
-  automationRules.push_back(rule);
-  saveAutomationRules();
-  
-  webServer.sendHeader("Location", "/automations");
-  webServer.send(303);
+uint8_t internDevice(const char* key) {
+  int pos = deviceTablePosition(key);
+  if (pos < 0) return NO_ID;
+  if (deviceTable[pos] != NO_ID) return deviceTable[pos];
+  if (deviceCount >= MAX_DEVICES || strlen(key) >= MAX_KEY_LEN) return NO_ID;
+
+  uint8_t id = deviceCount++;
+  resetDevice(id, key);
+  deviceTable[pos] = id;
+  registryGrew = true;
+  return id;
 }
 
-void handleDeleteRule() {
-  int index = webServer.arg("index").toInt();
-  if (index >= 0 && index < automationRules.size()) {
-    automationRules.erase(automationRules.begin() + index);
-    saveAutomationRules();
-  }
-  
-  webServer.sendHeader("Location", "/automations");
-  webServer.send(303);
+// Gives a released ID a new key; false if the key is taken or too long
+static bool rekeyDevice(uint8_t id, const char* key) {
+  int pos = deviceTablePosition(key);
+  if (pos < 0 || deviceTable[pos] != NO_ID || strlen(key) >= MAX_KEY_LEN) return false;
+  resetDevice(id, key);
+  deviceTable[pos] = id;
+  registryGrew = true;
+  return true;
 }
 
-void handleStats() {
-  int connectedDevices = 0;
-  for (int i = 0; i < MAX_CLIENTS; i++) {
-    if (clientConnected[i] && mqttClients[i].connected()) {
-      connectedDevices++;
+// Takes a device out of the table so its key no longer resolves; the ID
+// stays allocated with an empty key until rekeyDevice() reuses it. Entries
+// after it in the probe run are shifted back, so no lookup is cut short.
+static void releaseDevice(uint8_t id) {
+  int hole = deviceTablePosition(deviceStates[id].key);
+  if (hole < 0 || deviceTable[hole] != id) return;
+
+  const int mask = DEVICE_TABLE_SIZE - 1;
+  for (int next = (hole + 1) & mask; deviceTable[next] != NO_ID; next = (next + 1) & mask) {
+    int home = fnv1a(deviceStates[deviceTable[next]].key) & mask;
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      deviceTable[hole] = deviceTable[next];
+      hole = next;
     }
   }
-  
-  String html = "<html><body style='font-family:system-ui;background:#1a1a2e;color:#eee;padding:20px;'>";
-  html += "<h1 style='color:#00d4ff;'>Device Statistics</h1>";
-  html += "<p><a href='/' style='color:#00d4ff;'>← Back</a></p>";
-  html += "<p><strong>Connected Devices:</strong> " + String(connectedDevices) + "</p>";
-  html += "<p><strong>Active Rules:</strong> " + String(automationRules.size()) + "</p>";
-  html += "<p><strong>Uptime:</strong> " + String(millis() / 1000) + " seconds</p>";
-  html += "</body></html>";
-  
-  webServer.send(200, "text/html", html);
+  deviceTable[hole] = NO_ID;
+  resetDevice(id, "");
 }
 
-// -------------------------------------------------------------
-// Persistence
-// -------------------------------------------------------------
-void loadAutomationRules() {
-  int count = prefs.getInt("ruleCount", 0);
-  for (int i = 0; i < count; i++) {
-    String key = "rule" + String(i);
-    String data = prefs.getString(key.c_str(), "");
-    if (data.length() > 0) {
-      // Parse stored rule (simplified)
-      // Format: enabled|source|condition|target|payload
-      // TODO: Implement proper parsing
-    }
+uint8_t findField(const char* name) {
+  for (uint8_t i = 0; i < fieldCount; i++) {
+    if (strcmp(fieldNames[i], name) == 0) return i;
   }
+  return NO_ID;
 }
 
-void saveAutomationRules() {
-  prefs.putInt("ruleCount", automationRules.size());
-  for (size_t i = 0; i < automationRules.size(); i++) {
-    String key = "rule" + String(i);
-    // TODO: Serialize rule to string
-    // prefs.putString(key.c_str(), serialized);
-  }
+uint8_t internField(const char* name) {
+  uint8_t f = findField(name);
+  if (f != NO_ID) return f;
+  if (fieldCount >= MAX_FIELDS || strlen(name) >= MAX_KEY_LEN) return NO_ID;
+
+  strncpy(fieldNames[fieldCount], name, MAX_KEY_LEN - 1);
+  fieldNames[fieldCount][MAX_KEY_LEN - 1] = '\0';
+  registryGrew = true;
+  return fieldCount++;
+}
+
+void initDeviceState() {
+  memset(deviceTable, NO_ID, sizeof(deviceTable));
+  homeAggregate.device = NO_ID;
+  memset(slotDevice, NO_ID, sizeof(slotDevice));
+
+  // Known telemetry fields always get the same IDs
+  for (int i = 0; i < KNOWN_FIELD_COUNT; i++) {
+    internField(KNOWN_FIELD_NAMES[i]);
+  }
+}
+
+static inline bool readState(const DeviceState* states, uint8_t device, uint8_t field, float& out) {
+  if (device >= deviceCount || field >= MAX_FIELDS) return false;
+  const DeviceState& d = states[device];
+  if (!(d.presentMask & (1UL << field))) return false;
+  out = d.values[field];
+  return true;
+}
+
+void updateDeviceState(const String& topic, JsonDocument& doc) {
+  String key = deviceKeyFromTopic(topic);
+  uint8_t id = internDevice(key.c_str());
+  if (id == NO_ID) return;
+
+  DeviceState& d = deviceStates[id];
+  DeviceRecord& r = deviceRecords[id];
+  d.updatedMask = r.presencePending ? 1UL << FIELD_ONLINE : 0;
+  r.presencePending = false;
+  d.lastSeen = millis();
+
+  for (JsonPair kv : doc.as<JsonObject>()) {
+    JsonVariant v = kv.value();
+    if (v.is<const char*>() && strcmp(kv.key().c_str(), "fw") == 0) {
+      strncpy(r.fw, v.as<const char*>(), MAX_FW_LEN - 1);
+      continue;
+    }
+
+    bool isBool = v.is<bool>();
+    if (!isBool && !v.is<float>()) continue;  // Only numeric fields are cached
+
+    uint8_t f = internField(kv.key().c_str());
+    if (f == NO_ID) continue;
+
+    d.values[f] = isBool ? (v.as<bool>() ? 1.0f : 0.0f) : v.as<float>();
+    d.presentMask |= 1UL << f;
+    d.updatedMask |= 1UL << f;
+  }
+
+  summaryDirty = true;
+
+  recordHistory(id);
+  evaluateAutomations(id);
+}
+
+// -------------------------------------------------------------
+// Device Registry
+// -------------------------------------------------------------
+// Presence changes are mirrored into the "online" field so rules can use
+// them ("livingroom.online == 0") and are evaluated as they happen. A device
+// that comes back with telemetry is evaluated once its payload is applied,
+// so rules never see the new presence next to stale values.
+static void setPresence(uint8_t id, bool online, bool evaluate = true) {
+  DeviceRecord& r = deviceRecords[id];
+  if (r.online == online) return;
+  r.online = online;
+  if (!online) r.rate = 0;
+
+  DeviceState& d = deviceStates[id];
+  d.values[FIELD_ONLINE] = online ? 1.0f : 0.0f;
+  d.presentMask |= 1UL << FIELD_ONLINE;
+  summaryDirty = true;
+  Serial.printf("[REG] %s %s\n", d.key, online ? "online" : "offline");
+  if (!evaluate) {
+    r.presencePending = true;
+    return;
+  }
+  d.updatedMask = 1UL << FIELD_ONLINE;
+  evaluateAutomations(id);
+}
+
+// A telemetry message that didn't parse still brought its device back
+void evaluatePendingPresence(const String& topic) {
+  uint8_t id = findDevice(deviceKeyFromTopic(topic).c_str());
+  if (id == NO_ID || !deviceRecords[id].presencePending) return;
+  deviceRecords[id].presencePending = false;
+  deviceStates[id].updatedMask = 1UL << FIELD_ONLINE;
+  evaluateAutomations(id);
+}
+
+// Called for every routed message; only device-originated topics register
+void noteDeviceActivity(int slot, const char* topic, const char* payload) {
+  const char* kind = deviceTopicKind(topic);
+  if (!kind) return;
+
+  uint8_t cap;
+  if (strcmp(kind, "telemetry") == 0) cap = CAP_TELEMETRY;
+  else if (strcmp(kind, "status") == 0) cap = CAP_STATUS;
+  else if (strcmp(kind, "thresholds") == 0) cap = CAP_THRESHOLDS;
+  else return;
+
+  uint8_t id = internDevice(deviceKeyFromTopic(String(topic)).c_str());
+  if (id == NO_ID) return;
+
+  uint32_t now = millis();
+  DeviceRecord& r = deviceRecords[id];
+  if (r.messages > 0 && now > r.lastMessage) {
+    float instant = 60000.0f / (now - r.lastMessage);
+    r.rate += 0.2f * (instant - r.rate);
+  }
+  r.messages++;
+  r.lastMessage = now;
+  r.caps |= cap;
+  deviceStates[id].lastSeen = now;
+
+  if (r.slot != slot || r.session != clientSession[slot]) {
+    r.slot = slot;
+    r.session = clientSession[slot];
+    r.connects++;
+  }
+  slotDevice[slot] = id;
+
+  bool offline = cap == CAP_STATUS && strcmp(payload, "offline") == 0;
+  setPresence(id, !offline, cap != CAP_TELEMETRY);
+}
+
+void markSlotOffline(int slot) {
+  uint8_t id = slotDevice[slot];
+  slotDevice[slot] = NO_ID;
+  if (id != NO_ID && deviceRecords[id].slot == slot) setPresence(id, false);
+}
+
+// Devices that stop reporting without disconnecting
+void sweepPresence() {
+  static uint32_t lastSweep = 0;
+  uint32_t now = millis();
+  if (now - lastSweep < 1000) return;
+  lastSweep = now;
+
+  for (uint8_t id = 0; id < deviceCount; id++) {
+    if (deviceRecords[id].online && now - deviceRecords[id].lastMessage > PRESENCE_TIMEOUT_MS) {
+      setPresence(id, false);
+    }
+  }
+}
+
+// -------------------------------------------------------------
+// Home Aggregates
+// -------------------------------------------------------------
+static void resetArea(AreaAggregate& area) {
+  area.members = 0;
+  area.alertFlags = 0;
+  for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+    area.fields[f] = { 0, 0, 0, 0 };
+  }
+}
+
+static void addToArea(AreaAggregate& area, const DeviceState& d) {
+  area.members++;
+  for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+    if (!(d.presentMask & (1UL << f))) continue;
+    float v = d.values[f];
+    if (f == FIELD_ALERT_FLAGS) {
+      area.alertFlags |= (uint32_t)v;
+      continue;
+    }
+    FieldAggregate& a = area.fields[f];
+    a.min = a.count ? min(a.min, v) : v;
+    a.max = a.count ? max(a.max, v) : v;
+    a.sum += v;
+    a.count++;
+  }
+}
+
+// Room of a device, from its alias; empty if it has none
+static const String* roomOf(const char* key) {
+  for (const auto& alias : deviceAliases) {
+    if (alias.deviceKey == key) return alias.room.length() > 0 ? &alias.room : &alias.name;
+  }
+  return nullptr;
+}
+
+static AreaAggregate* roomArea(const String& name) {
+  for (uint8_t i = 0; i < roomCount; i++) {
+    if (roomAggregates[i].name == name) return &roomAggregates[i];
+  }
+  if (roomCount >= MAX_ROOMS) {
+    if (!roomTableFullLogged) {
+      Serial.printf("[AREA] Room table full (%d), %s not aggregated\n", MAX_ROOMS, name.c_str());
+      roomTableFullLogged = true;
+    }
+    return nullptr;
+  }
+
+  AreaAggregate& area = roomAggregates[roomCount];
+  String key = "room/" + name;
+  area.name = name;
+  area.device = findDevice(key.c_str());
+  if (area.device == NO_ID && spareRoomCount > 0 && rekeyDevice(spareRoomDevices[spareRoomCount - 1], key.c_str())) {
+    area.device = spareRoomDevices[--spareRoomCount];
+  } else if (area.device == NO_ID) {
+    area.device = internDevice(key.c_str());
+  }
+  if (area.device != NO_ID) aggregateDeviceMask |= 1UL << area.device;
+  roomCount++;
+  return &area;
+}
+
+static bool roomReferenced(const String& name) {
+  for (const auto& alias : deviceAliases) {
+    if ((alias.room.length() > 0 ? alias.room : alias.name) == name) return true;
+  }
+  return false;
+}
+
+// Frees rooms no alias points at any more, and their pseudo-devices, so
+// renamed and removed rooms don't use up the table. Rules on a freed room
+// become unresolved when they are recompiled.
+void pruneRooms() {
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < roomCount; i++) {
+    AreaAggregate& area = roomAggregates[i];
+    if (roomReferenced(area.name)) {
+      if (kept != i) roomAggregates[kept] = area;
+      kept++;
+      continue;
+    }
+
+    Serial.printf("[AREA] Room %s freed\n", area.name.c_str());
+    if (area.device != NO_ID) {
+      releaseDevice(area.device);   // Keeps its aggregateDeviceMask bit while spare
+      spareRoomDevices[spareRoomCount++] = area.device;
+    }
+    roomTableFullLogged = false;
+  }
+  roomCount = kept;
+}
+
+// Rooms worse in air quality sort later: more alert flags, then more dust
+static bool worseArea(const AreaAggregate& a, const AreaAggregate& b) {
+  int flagsA = __builtin_popcount(a.alertFlags);
+  int flagsB = __builtin_popcount(b.alertFlags);
+  if (flagsA != flagsB) return flagsA > flagsB;
+  float dustA = a.fields[FIELD_DUST].count ? a.fields[FIELD_DUST].sum / a.fields[FIELD_DUST].count : 0;
+  float dustB = b.fields[FIELD_DUST].count ? b.fields[FIELD_DUST].sum / b.fields[FIELD_DUST].count : 0;
+  return dustA > dustB;
+}
+
+// Writes an area's means into its pseudo-device and runs the rules that use it
+static void storeArea(const AreaAggregate& area) {
+  if (area.device == NO_ID) return;
+
+  DeviceState& d = deviceStates[area.device];
+  d.updatedMask = 0;
+  d.lastSeen = millis();
+  uint32_t cleared = 0;
+  for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+    const FieldAggregate& a = area.fields[f];
+    bool reported = f == FIELD_ALERT_FLAGS ? area.members > 0 : a.count > 0;
+    if (!reported) {
+      // Nobody online reports it: drop the value so rules stop matching on it
+      cleared |= d.presentMask & (1UL << f);
+      d.presentMask &= ~(1UL << f);
+      continue;
+    }
+    d.values[f] = f == FIELD_ALERT_FLAGS ? (float)area.alertFlags : a.sum / a.count;
+    d.presentMask |= 1UL << f;
+    d.updatedMask |= 1UL << f;
+  }
+  if (d.updatedMask || cleared) evaluateAutomations(area.device);
+}
+
+static void rebuildAggregates() {
+  if (homeAggregate.device == NO_ID && deviceCount < MAX_DEVICES) {
+    homeAggregate.name = "home";
+    homeAggregate.device = internDevice("home");
+    if (homeAggregate.device != NO_ID) aggregateDeviceMask |= 1UL << homeAggregate.device;
+  }
+
+  resetArea(homeAggregate);
+  for (uint8_t i = 0; i < roomCount; i++) {
+    resetArea(roomAggregates[i]);
+  }
+
+  for (uint8_t id = 0; id < deviceCount; id++) {
+    if ((aggregateDeviceMask & (1UL << id)) || !deviceRecords[id].online) continue;
+    const DeviceState& d = deviceStates[id];
+    addToArea(homeAggregate, d);
+
+    const String* room = roomOf(d.key);
+    AreaAggregate* area = room ? roomArea(*room) : nullptr;
+    if (area) addToArea(*area, d);
+  }
+
+  storeArea(homeAggregate);
+  for (uint8_t i = 0; i < roomCount; i++) {
+    storeArea(roomAggregates[i]);
+  }
+}
+
+// {"online":3,"home":{"temp":[mean,min,max,n],...,"alertFlags":0},
+//  "rooms":[{"room":"kitchen","n":1,"temp":24.5,...,"alertFlags":4}],"worstRoom":"kitchen"}
+static void buildSummary(String& out) {
+  DynamicJsonDocument doc(2048);
+  doc["online"] = homeAggregate.members;
+
+  JsonObject home = doc.createNestedObject("home");
+  for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+    const FieldAggregate& a = homeAggregate.fields[f];
+    if (f == FIELD_ALERT_FLAGS || a.count == 0) continue;
+    JsonArray stats = home.createNestedArray(fieldNames[f]);
+    stats.add(a.sum / a.count);
+    stats.add(a.min);
+    stats.add(a.max);
+    stats.add(a.count);
+  }
+  home["alertFlags"] = homeAggregate.alertFlags;
+
+  JsonArray rooms = doc.createNestedArray("rooms");
+  const AreaAggregate* worst = nullptr;
+  for (uint8_t i = 0; i < roomCount; i++) {
+    const AreaAggregate& area = roomAggregates[i];
+    if (area.members == 0) continue;
+    JsonObject room = rooms.createNestedObject();
+    room["room"] = area.name.c_str();
+    room["n"] = area.members;
+    for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+      const FieldAggregate& a = area.fields[f];
+      if (f != FIELD_ALERT_FLAGS && a.count > 0) room[fieldNames[f]] = a.sum / a.count;
+    }
+    room["alertFlags"] = area.alertFlags;
+    if (!worst || worseArea(area, *worst)) worst = &area;
+  }
+  if (worst) doc["worstRoom"] = worst->name.c_str();
+
+  serializeJson(doc, out);
+}
+
+// Recomputes and publishes the summary at a fixed rate, skipping quiet periods
+void serviceSummary() {
+  static uint32_t lastTick = 0;
+  static uint32_t lastPublish = 0;
+  uint32_t now = millis();
+  if (now - lastTick < SUMMARY_INTERVAL_MS) return;
+  lastTick = now;
+
+  if (!summaryDirty && now - lastPublish < SUMMARY_HEARTBEAT_MS) return;
+  summaryDirty = false;
+  lastPublish = now;
+
+  rebuildAggregates();
+  if (deviceCount <= __builtin_popcount(aggregateDeviceMask)) return;   // No real devices yet
+
+  String payload;
+  buildSummary(payload);
+  String message = String(SUMMARY_TOPIC) + "|" + payload;
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (clientConnected[i] && mqttClients[i].connected()) {
+      countForward(i, mqttClients[i].println(message));
+    }
+  }
+  publishEvent(SUMMARY_TOPIC, payload);
+  bridgeForward(SUMMARY_TOPIC, payload);
+}
+
+// -------------------------------------------------------------
+// Telemetry History
+// -------------------------------------------------------------
+static size_t historyBytesPerDevice() {
+  size_t bytes = 0;
+  for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+    uint16_t slots = psramFound() ? HISTORY_TIERS[t].slotsPsram : HISTORY_TIERS[t].slotsHeap;
+    bytes += (size_t)slots * (sizeof(uint32_t) + sizeof(HistoryBucket) * HISTORY_FIELD_COUNT);
+  }
+  return bytes;
+}
+
+void initHistory() {
+  historyDeviceLimit = psramFound() ? HISTORY_DEVICES_PSRAM : HISTORY_DEVICES_HEAP;
+  Serial.printf("[HIST] %u bytes per device, up to %u devices (%s)\n",
+                (unsigned)historyBytesPerDevice(), historyDeviceLimit, psramFound() ? "PSRAM" : "heap");
+}
+
+static void resetOpenBucket(HistoryTier& tier, uint32_t start) {
+  tier.openStart = start;
+  for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+    tier.openCount[f] = 0;
+    tier.openSum[f] = 0;
+  }
+}
+
+static bool allocHistory(DeviceHistory& h) {
+  if (historyDevices >= historyDeviceLimit) return false;
+
+  size_t bytes = historyBytesPerDevice();
+  uint8_t* block = (uint8_t*)(psramFound() ? ps_malloc(bytes) : malloc(bytes));
+  if (!block) return false;
+
+  for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+    HistoryTier& tier = h.tiers[t];
+    tier.slots = psramFound() ? HISTORY_TIERS[t].slotsPsram : HISTORY_TIERS[t].slotsHeap;
+    tier.start = (uint32_t*)block;
+    block += tier.slots * sizeof(uint32_t);
+    tier.buckets = (HistoryBucket*)block;
+    block += tier.slots * sizeof(HistoryBucket) * HISTORY_FIELD_COUNT;
+    tier.head = 0;
+    tier.count = 0;
+    resetOpenBucket(tier, 0);
+  }
+
+  h.allocated = true;
+  historyDevices++;
+  return true;
+}
+
+// Index of the first closed bucket starting at or after t
+static uint16_t firstRowFrom(const HistoryTier& tier, uint32_t t) {
+  uint16_t lo = 0, hi = tier.count;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if (tier.rowStart(mid) < t) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Summary of a tier's open bucket for one field
+static bool openBucket(const HistoryTier& tier, int field, HistoryBucket& out) {
+  uint16_t n = tier.openCount[field];
+  if (n == 0) return false;
+  out.min = tier.openMin[field];
+  out.max = tier.openMax[field];
+  out.mean = tier.openSum[field] / n;
+  return true;
+}
+
+// Returns false if the open bucket was empty
+static bool closeBucket(HistoryTier& tier) {
+  bool any = false;
+  for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+    any |= tier.openCount[f] > 0;
+  }
+  if (!any) return false;
+
+  uint16_t slot;
+  if (tier.count < tier.slots) {
+    slot = (tier.head + tier.count) % tier.slots;
+    tier.count++;
+  } else {
+    slot = tier.head;
+    tier.head = (tier.head + 1) % tier.slots;
+  }
+
+  tier.start[slot] = tier.openStart;
+  HistoryBucket* row = &tier.buckets[slot * HISTORY_FIELD_COUNT];
+  for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+    if (!openBucket(tier, f, row[f])) row[f] = { NAN, NAN, NAN };
+  }
+  return true;
+}
+
+// Moves a tier on to the bucket holding now, closing the one that ended
+static void rollTier(uint8_t device, int t, uint32_t now) {
+  HistoryTier& tier = deviceHistory[device].tiers[t];
+  uint32_t bucketStart = now - now % HISTORY_TIERS[t].stepSec;
+  if (bucketStart == tier.openStart) return;
+  if (closeBucket(tier) && t == TIER_MINUTE) archiveBucket(device, tier);
+  resetOpenBucket(tier, bucketStart);
+}
+
+// Folds the fields carried by the device's latest message into every tier
+void recordHistory(uint8_t device) {
+  DeviceHistory& h = deviceHistory[device];
+  if (!h.allocated && !allocHistory(h)) return;
+
+  const DeviceState& d = deviceStates[device];
+  uint32_t now = millis() / 1000;
+
+  for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+    HistoryTier& tier = h.tiers[t];
+    rollTier(device, t, now);
+
+    for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+      if (!(d.updatedMask & (1UL << f))) continue;
+      float v = d.values[f];
+      if (tier.openCount[f] == 0) {
+        tier.openMin[f] = v;
+        tier.openMax[f] = v;
+      } else {
+        tier.openMin[f] = min(tier.openMin[f], v);
+        tier.openMax[f] = max(tier.openMax[f], v);
+      }
+      tier.openSum[f] += v;
+      tier.openCount[f]++;
+    }
+  }
+}
+
+// Closes buckets whose time is up without waiting for the device's next
+// sample, so a device that goes quiet still gets its last minute and hour
+// into the tiers and the archive
+void sweepHistory() {
+  static uint32_t lastSweep = 0;
+  uint32_t nowMs = millis();
+  if (nowMs - lastSweep < 1000) return;
+  lastSweep = nowMs;
+
+  uint32_t now = nowMs / 1000;
+  for (uint8_t id = 0; id < deviceCount; id++) {
+    if (!deviceHistory[id].allocated) continue;
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+      rollTier(id, t, now);
+    }
+  }
+}
+
+// -------------------------------------------------------------
+// Sliding Window Aggregates
+// -------------------------------------------------------------
+void WindowAggregate::push(uint32_t now, float v) {
+  expire(now);
+  if (count == WINDOW_CAPACITY) evictOldest();
+
+  uint16_t idx = (head + count) % WINDOW_CAPACITY;
+  ts[idx] = now;
+  values[idx] = v;
+  count++;
+  sum += v;
+
+  // Drop dominated entries from the back, then append
+  while (minCount > 0 && values[minDeque[(minHead + minCount - 1) % WINDOW_CAPACITY]] >= v) minCount--;
+  minDeque[(minHead + minCount) % WINDOW_CAPACITY] = idx;
+  minCount++;
+
+  while (maxCount > 0 && values[maxDeque[(maxHead + maxCount - 1) % WINDOW_CAPACITY]] <= v) maxCount--;
+  maxDeque[(maxHead + maxCount) % WINDOW_CAPACITY] = idx;
+  maxCount++;
+}
+
+void WindowAggregate::expire(uint32_t now) {
+  while (count > 0 && now - ts[head] > windowMs) {
+    evictOldest();
+  }
+}
+
+void WindowAggregate::evictOldest() {
+  sum -= values[head];
+  if (minCount > 0 && minDeque[minHead] == head) {
+    minHead = (minHead + 1) % WINDOW_CAPACITY;
+    minCount--;
+  }
+  if (maxCount > 0 && maxDeque[maxHead] == head) {
+    maxHead = (maxHead + 1) % WINDOW_CAPACITY;
+    maxCount--;
+  }
+  head = (head + 1) % WINDOW_CAPACITY;
+  count--;
+  if (count == 0) sum = 0;  // Don't let float drift survive an empty window
+}
+
+float WindowAggregate::ratePerSecond() const {
+  if (count < 2) return 0;
+  uint16_t newest = (head + count - 1) % WINDOW_CAPACITY;
+  uint32_t dt = ts[newest] - ts[head];
+  if (dt == 0) return 0;
+  return (values[newest] - values[head]) * 1000.0f / dt;
+}
+
+// -------------------------------------------------------------
+// Rule Condition Compiler
+// -------------------------------------------------------------
+struct ConditionParser {
+  AutomationRule& rule;
+  const char* p;
+  uint8_t defaultDevice;
+};
+
+static void skipSpaces(const char*& p) {
+  while (*p == ' ' || *p == '\t') p++;
+}
+
+static bool isRefChar(char c) {
+  return isalnum((unsigned char)c) || c == '_' || c == '-' || c == '/';
+}
+
+static bool parseToken(const char*& p, String& out) {
+  const char* start = p;
+  while (isRefChar(*p)) p++;
+  if (p == start) return false;
+  out = "";
+  out.concat(start, p - start);
+  return true;
+}
+
+// Parses "30s", "5m", "1h", "500ms"; bare numbers are seconds, a bare unit means one
+static bool parseDuration(const char*& p, uint32_t& outMs) {
+  float n = 1;
+  if (isdigit((unsigned char)*p) || *p == '.') {
+    char* end;
+    n = strtof(p, &end);
+    p = end;
+  }
+  if (n <= 0) return false;
+
+  if (strncmp(p, "ms", 2) == 0)       { outMs = (uint32_t)n;             p += 2; }
+  else if (strncmp(p, "min", 3) == 0) { outMs = (uint32_t)(n * 60000);   p += 3; }
+  else if (*p == 's')                 { outMs = (uint32_t)(n * 1000);    p++; }
+  else if (*p == 'm')                 { outMs = (uint32_t)(n * 60000);   p++; }
+  else if (*p == 'h')                 { outMs = (uint32_t)(n * 3600000); p++; }
+  else                                { outMs = (uint32_t)(n * 1000); }
+  return outMs > 0;
+}
+
+// Matches AND/OR (any case) or their symbolic forms, consuming them
+static bool parseKeyword(const char*& p, const char* word, const char* symbol) {
+  size_t len = strlen(word);
+  if (strncasecmp(p, word, len) == 0 && !isRefChar(p[len])) {
+    p += len;
+    return true;
+  }
+  if (strncmp(p, symbol, 2) == 0) {
+    p += 2;
+    return true;
+  }
+  return false;
+}
+
+// Lookups only: a typo or a probing client must not use up registry slots
+static uint8_t resolveDevice(const String& name) {
+  for (const auto& alias : deviceAliases) {
+    if (alias.name == name) return findDevice(alias.deviceKey.c_str());
+  }
+  return findDevice(name.c_str());
+}
+
+static bool addNode(ConditionParser& ps, const ConditionNode& node, uint8_t& out) {
+  if (ps.rule.nodes.size() >= NO_ID) return false;
+  out = ps.rule.nodes.size();
+  ps.rule.nodes.push_back(node);
+  return true;
+}
+
+// [device.]field. A device or field that has not reported yet stays
+// NO_ID (never true) and marks the rule for recompiling once it does.
+static bool parseRef(ConditionParser& ps, ConditionNode& node) {
+  String first, field;
+  if (!parseToken(ps.p, first)) return false;
+
+  if (*ps.p == '.') {
+    ps.p++;
+    if (!parseToken(ps.p, field)) return false;
+    node.device = resolveDevice(first);
+  } else {
+    if (ps.rule.sourceTopic.length() == 0) return false;  // No device to default to
+    field = first;
+    node.device = ps.defaultDevice;
+  }
+  node.field = findField(field.c_str());
+
+  if (node.device == NO_ID || node.field == NO_ID) {
+    node.device = node.field = NO_ID;
+    ps.rule.unresolved = true;
+    return true;
+  }
+  ps.rule.deviceMask |= 1UL << node.device;
+  return true;
+}
+
+// operand op number[/unit]
+static bool parseComparison(ConditionParser& ps, uint8_t& out) {
+  ConditionNode node;
+  const char*& p = ps.p;
+
+  // Look ahead for an aggregate function: ident '('
+  const char* save = p;
+  String ident;
+  if (!parseToken(p, ident)) return false;
+  skipSpaces(p);
+
+  if (*p == '(') {
+    if (ident == "avg") node.agg = AGG_AVG;
+    else if (ident == "min") node.agg = AGG_MIN;
+    else if (ident == "max") node.agg = AGG_MAX;
+    else if (ident == "rate") node.agg = AGG_RATE;
+    else return false;
+
+    p++;
+    skipSpaces(p);
+    if (!parseRef(ps, node)) return false;
+    skipSpaces(p);
+
+    if (*p == ',') {
+      p++;
+      skipSpaces(p);
+      if (!parseDuration(p, node.windowMs)) return false;
+      // A longer window would silently become "the last WINDOW_CAPACITY samples"
+      if (node.windowMs > WINDOW_MAX_MS) return false;
+      skipSpaces(p);
+    } else if (node.agg == AGG_RATE) {
+      node.windowMs = DEFAULT_RATE_WINDOW_MS;
+    } else {
+      return false;  // avg/min/max need an explicit window
+    }
+
+    if (*p != ')') return false;
+    p++;
+
+    if (ps.rule.windows.size() >= NO_ID) return false;
+    node.window = ps.rule.windows.size();
+    ps.rule.windows.emplace_back(new WindowAggregate(node.windowMs));
+  } else {
+    p = save;
+    if (!parseRef(ps, node)) return false;
+  }
+  skipSpaces(p);
+
+  // Operator
+  if (strncmp(p, ">=", 2) == 0)      { node.op = OP_GE; p += 2; }
+  else if (strncmp(p, "<=", 2) == 0) { node.op = OP_LE; p += 2; }
+  else if (strncmp(p, "==", 2) == 0) { node.op = OP_EQ; p += 2; }
+  else if (*p == '>')                { node.op = OP_GT; p++; }
+  else if (*p == '<')                { node.op = OP_LT; p++; }
+  else return false;
+  skipSpaces(p);
+
+  // Threshold, with an optional "/s", "/min" or "/h" unit for rates
+  char* end;
+  node.value = strtof(p, &end);
+  if (end == p) return false;
+  p = end;
+
+  if (*p == '/') {
+    if (node.agg != AGG_RATE) return false;
+    p++;
+    uint32_t perMs = 0;
+    if (!parseDuration(p, perMs)) return false;
+    node.value = node.value * 1000.0f / perMs;
+  } else if (node.agg == AGG_RATE) {
+    node.value = node.value / 60.0f;  // Bare rate thresholds are per minute
+  }
+
+  return addNode(ps, node, out);
+}
+
+static bool parseOr(ConditionParser& ps, uint8_t& out);
+
+static bool parsePrimary(ConditionParser& ps, uint8_t& out) {
+  skipSpaces(ps.p);
+  if (*ps.p == '(') {
+    ps.p++;
+    if (!parseOr(ps, out)) return false;
+    skipSpaces(ps.p);
+    if (*ps.p != ')') return false;
+    ps.p++;
+    return true;
+  }
+  return parseComparison(ps, out);
+}
+
+static bool parseAnd(ConditionParser& ps, uint8_t& out) {
+  if (!parsePrimary(ps, out)) return false;
+  for (;;) {
+    skipSpaces(ps.p);
+    if (!parseKeyword(ps.p, "AND", "&&")) return true;
+
+    ConditionNode node;
+    node.type = NODE_AND;
+    node.lhs = out;
+    if (!parsePrimary(ps, node.rhs)) return false;
+    if (!addNode(ps, node, out)) return false;
+  }
+}
+
+static bool parseOr(ConditionParser& ps, uint8_t& out) {
+  if (!parseAnd(ps, out)) return false;
+  for (;;) {
+    skipSpaces(ps.p);
+    if (!parseKeyword(ps.p, "OR", "||")) return true;
+
+    ConditionNode node;
+    node.type = NODE_OR;
+    node.lhs = out;
+    if (!parseAnd(ps, node.rhs)) return false;
+    if (!addNode(ps, node, out)) return false;
+  }
+}
+
+bool compileRule(AutomationRule& rule) {
+  rule.nodes.clear();
+  rule.windows.clear();
+  rule.deviceMask = 0;
+  rule.unresolved = false;
+
+  uint8_t defaultDevice = NO_ID;
+  if (rule.sourceTopic.length() > 0) {
+    defaultDevice = findDevice(deviceKeyFromTopic(rule.sourceTopic).c_str());
+  }
+
+  ConditionParser ps = { rule, rule.condition.c_str(), defaultDevice };
+  if (!parseOr(ps, rule.root)) return false;
+  skipSpaces(ps.p);
+  return *ps.p == '\0';
+}
+
+// Rules naming a device or field that has since appeared (their window
+// history restarts, which only matters for refs that already resolved)
+static void resolvePendingRules() {
+  if (!registryGrew) return;
+  registryGrew = false;
+  for (auto& rule : automationRules) {
+    if (rule.unresolved) compileRule(rule);
+  }
+}
+
+// Re-resolves aliases after they change (window history restarts)
+void recompileRules() {
+  for (auto& rule : automationRules) {
+    if (!compileRule(rule)) {
+      rule.enabled = false;
+      Serial.printf("[AUTO] Rule disabled, no longer compiles: %s\n", rule.condition.c_str());
+    }
+  }
+}
+
+static bool compareValue(float lhs, ConditionOp op, float rhs) {
+  switch (op) {
+    case OP_GT: return lhs > rhs;
+    case OP_LT: return lhs < rhs;
+    case OP_EQ: return lhs == rhs;
+    case OP_GE: return lhs >= rhs;
+    case OP_LE: return lhs <= rhs;
+  }
+  return false;
+}
+
+// -------------------------------------------------------------
+// Automation Rule Evaluation
+// -------------------------------------------------------------
+static bool evaluateNode(const AutomationRule& rule, uint8_t index, uint32_t now, const DeviceState* states) {
+  const ConditionNode& node = rule.nodes[index];
+
+  // Short-circuit compound conditions
+  if (node.type == NODE_AND) return evaluateNode(rule, node.lhs, now, states) && evaluateNode(rule, node.rhs, now, states);
+  if (node.type == NODE_OR)  return evaluateNode(rule, node.lhs, now, states) || evaluateNode(rule, node.rhs, now, states);
+
+  float lhs = 0;
+  if (node.agg == AGG_NONE) {
+    if (!readState(states, node.device, node.field, lhs)) return false;
+  } else {
+    WindowAggregate& w = *rule.windows[node.window];
+    w.expire(now);
+    if (!w.ready()) return false;
+
+    switch (node.agg) {
+      case AGG_AVG:  lhs = w.avg(); break;
+      case AGG_MIN:  lhs = w.minValue(); break;
+      case AGG_MAX:  lhs = w.maxValue(); break;
+      case AGG_RATE: lhs = w.ratePerSecond(); break;
+      default: break;
+    }
+  }
+  return compareValue(lhs, node.op, node.value);
+}
+
+void evaluateAutomations(uint8_t device) {
+  resolvePendingRules();
+  uint32_t now = millis();
+  const DeviceState& state = deviceStates[device];
+
+  for (auto& rule : automationRules) {
+    if (!rule.enabled) continue;
+    
+    // Only rules that reference the updated device
+    if (!(rule.deviceMask & (1UL << device))) continue;
+
+    // Feed this device's windows before evaluating, so short-circuiting never skips a sample
+    for (const auto& node : rule.nodes) {
+      if (node.type == NODE_CMP && node.agg != AGG_NONE && node.device == device &&
+          (state.updatedMask & (1UL << node.field))) {
+        rule.windows[node.window]->push(now, state.values[node.field]);
+      }
+    }
+
+    if (evaluateNode(rule, rule.root, now, deviceStates)) {
+      Serial.printf("[AUTO] Rule triggered: %s\n", rule.condition.c_str());
+      Serial.printf("[AUTO] Publishing to: %s\n", rule.targetTopic.c_str());
+      
+      // Publish to all connected clients
+      String message = rule.targetTopic + "|" + rule.targetPayload;
+      bump(metrics.rulesFired);
+      for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clientConnected[i] && mqttClients[i].connected()) {
+          countForward(i, mqttClients[i].println(message));
+        }
+      }
+      publishEvent(rule.targetTopic, rule.targetPayload);
+    }
+  }
+}
+
+// -------------------------------------------------------------
+// Rule Backtesting
+// -------------------------------------------------------------
+// Replays the 1-minute history (bucket means; min/max for min()/max() windows)
+// of every device a rule references
+// in timestamp order through a scratch state table and fresh windows. Firings are counted
+// per evaluation (as the live engine publishes) and per episode (false -> true).
+struct BacktestResult {
+  uint32_t fromSec = 0;        // First and last replayed minute; the range actually covered
+  uint32_t toSec = 0;
+  uint32_t evaluated = 0;
+  uint32_t fired = 0;
+  uint32_t episodes = 0;
+  uint32_t timestamps[MAX_BACKTEST_TIMESTAMPS];  // Episode starts, seconds since boot
+  uint32_t elapsedUs = 0;
+};
+
+bool backtestRule(AutomationRule& rule, uint32_t sinceSec, BacktestResult& result, String& error) {
+  uint32_t started = micros();
+
+  // Only fields and devices with history can be replayed, and only windows
+  // that span at least one bucket mean anything over minute data
+  for (const auto& node : rule.nodes) {
+    if (node.type != NODE_CMP) continue;
+    if (node.field >= HISTORY_FIELD_COUNT) {
+      error = String("No history for field: ") + fieldNames[node.field];
+      return false;
+    }
+    if (!deviceHistory[node.device].allocated) {
+      error = String("No history for device: ") + deviceStates[node.device].key;
+      return false;
+    }
+    if (node.agg != AGG_NONE && node.windowMs < HISTORY_TIERS[TIER_MINUTE].stepSec * 1000) {
+      error = "Windows under 1 minute cannot be replayed from 1-minute history";
+      return false;
+    }
+  }
+
+  std::unique_ptr<DeviceState[]> replay(new (std::nothrow) DeviceState[MAX_DEVICES]);
+  if (!replay) {
+    error = "Out of memory";
+    return false;
+  }
+  memset(replay.get(), 0, sizeof(DeviceState) * MAX_DEVICES);
+
+  // Per-device read cursor, skipping rows older than the requested range
+  uint16_t cursor[MAX_DEVICES] = {};
+  for (uint8_t d = 0; d < deviceCount; d++) {
+    const HistoryTier& tier = deviceHistory[d].tiers[TIER_MINUTE];
+    if (!(rule.deviceMask & (1UL << d)) || !deviceHistory[d].allocated) continue;
+    while (cursor[d] < tier.count && tier.rowStart(cursor[d]) < sinceSec) cursor[d]++;
+  }
+
+  bool wasTriggered = false;
+  for (;;) {
+    // Next row across devices, oldest first
+    uint8_t next = NO_ID;
+    uint32_t nextTs = UINT32_MAX;
+    for (uint8_t d = 0; d < deviceCount; d++) {
+      const HistoryTier& tier = deviceHistory[d].tiers[TIER_MINUTE];
+      if (!(rule.deviceMask & (1UL << d)) || !deviceHistory[d].allocated || cursor[d] >= tier.count) continue;
+      uint32_t t = tier.rowStart(cursor[d]);
+      if (t < nextTs) {
+        nextTs = t;
+        next = d;
+      }
+    }
+    if (next == NO_ID) break;
+
+    const HistoryBucket* row = deviceHistory[next].tiers[TIER_MINUTE].row(cursor[next]);
+    cursor[next]++;
+    if (result.evaluated == 0) result.fromSec = nextTs;
+    result.toSec = nextTs;
+
+    DeviceState& state = replay[next];
+    state.updatedMask = 0;
+    for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+      float v = row[f].mean;
+      if (isnan(v)) continue;
+      state.values[f] = v;
+      state.presentMask |= 1UL << f;
+      state.updatedMask |= 1UL << f;
+    }
+
+    // min()/max() windows see the bucket extremes, not its mean
+    uint32_t nowMs = nextTs * 1000;
+    for (const auto& node : rule.nodes) {
+      if (node.type == NODE_CMP && node.agg != AGG_NONE && node.device == next &&
+          (state.updatedMask & (1UL << node.field))) {
+        const HistoryBucket& b = row[node.field];
+        float v = node.agg == AGG_MIN ? b.min : (node.agg == AGG_MAX ? b.max : b.mean);
+        rule.windows[node.window]->push(nowMs, v);
+      }
+    }
+
+    bool triggered = evaluateNode(rule, rule.root, nowMs, replay.get());
+    result.evaluated++;
+    if (triggered) {
+      result.fired++;
+      if (!wasTriggered) {
+        if (result.episodes < MAX_BACKTEST_TIMESTAMPS) result.timestamps[result.episodes] = nextTs;
+        result.episodes++;
+      }
+    }
+    wasTriggered = triggered;
+  }
+
+  result.elapsedUs = micros() - started;
+  return true;
+}
+
+// -------------------------------------------------------------
+// HTTP Server (non-blocking)
+// -------------------------------------------------------------
+static const char* statusText(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 408: return "Request Timeout";
+    case 413: return "Payload Too Large";
+    case 503: return "Service Unavailable";
+    default:  return code < 400 ? "OK" : "Error";
+  }
+}
+
+static String urlDecode(const String& in) {
+  String out;
+  out.reserve(in.length());
+  for (size_t i = 0; i < in.length(); i++) {
+    char c = in[i];
+    if (c == '+') {
+      out += ' ';
+    } else if (c == '%' && i + 2 < in.length()) {
+      char hex[3] = { in[i + 1], in[i + 2], '\0' };
+      out += (char)strtol(hex, nullptr, 16);
+      i += 2;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+void HubHttpServer::collectHeaders(const char* keys[], size_t count) {
+  headerKeys.clear();
+  for (size_t i = 0; i < count; i++) {
+    headerKeys.push_back(keys[i]);
+  }
+}
+
+// One step for every connection: accept, read what has arrived, dispatch if complete
+void HubHttpServer::handleClient() {
+  accept();
+  for (int i = 0; i < MAX_HTTP_CONNECTIONS; i++) {
+    if (connections[i].active) poll(connections[i]);
+  }
+}
+
+void HubHttpServer::accept() {
+  if (!server.hasClient()) return;
+
+  WiFiClient client = server.available();
+  for (int i = 0; i < MAX_HTTP_CONNECTIONS; i++) {
+    HttpConnection& conn = connections[i];
+    if (!conn.active) {
+      conn.active = true;
+      conn.client = client;
+      conn.request = "";
+      conn.headerEnd = -1;
+      conn.contentLength = 0;
+      conn.started = millis();
+      return;
+    }
+  }
+
+  // All slots busy: refuse instead of queueing
+  rejectedCount++;
+  client.print("HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+  client.stop();
+}
+
+void HubHttpServer::poll(HttpConnection& conn) {
+  if (conn.responding) {
+    flushResponse(conn);
+    return;
+  }
+  if (!conn.client.connected() && conn.client.available() == 0) {
+    close(conn);
+    return;
+  }
+
+  size_t budget = HTTP_READ_CHUNK;
+  uint8_t buf[64];
+  while (budget > 0) {
+    int available = conn.client.available();
+    if (available <= 0) break;
+    int n = conn.client.read(buf, min((size_t)available, min(budget, sizeof(buf))));
+    if (n <= 0) break;
+    conn.request.concat((const char*)buf, n);
+    budget -= n;
+  }
+
+  if (conn.request.length() > HTTP_MAX_REQUEST) {
+    reply(conn, 413, "Request too large");
+    return;
+  }
+
+  if (conn.headerEnd < 0) {
+    int end = conn.request.indexOf("\r\n\r\n");
+    if (end >= 0) {
+      conn.headerEnd = end + 4;
+      String lower = conn.request.substring(0, end);
+      lower.toLowerCase();
+      int cl = lower.indexOf("\r\ncontent-length:");
+      if (cl >= 0) conn.contentLength = lower.substring(cl + 17).toInt();
+      if (conn.headerEnd + conn.contentLength > HTTP_MAX_REQUEST) {
+        reply(conn, 413, "Request too large");
+        return;
+      }
+    }
+  }
+
+  if (conn.headerEnd >= 0 && conn.request.length() >= conn.headerEnd + conn.contentLength) {
+    dispatch(conn);
+  } else if (millis() - conn.started > HTTP_REQUEST_TIMEOUT_MS) {
+    timeoutCount++;
+    reply(conn, 408, "Request timeout");
+  }
+}
+
+bool HubHttpServer::parseRequest(HttpConnection& conn) {
+  int lineEnd = conn.request.indexOf("\r\n");
+  int sp1 = conn.request.indexOf(' ');
+  int sp2 = conn.request.indexOf(' ', sp1 + 1);
+  if (sp1 <= 0 || sp2 <= sp1 || sp2 > lineEnd) return false;
+
+  String method = conn.request.substring(0, sp1);
+  if (method == "GET") requestMethod = HTTP_GET;
+  else if (method == "POST") requestMethod = HTTP_POST;
+  else if (method == "PUT") requestMethod = HTTP_PUT;
+  else if (method == "DELETE") requestMethod = HTTP_DELETE;
+  else if (method == "OPTIONS") requestMethod = HTTP_OPTIONS;
+  else return false;
+
+  String target = conn.request.substring(sp1 + 1, sp2);
+  int query = target.indexOf('?');
+  path = urlDecode(query < 0 ? target : target.substring(0, query));
+  args.clear();
+  if (query >= 0) parseArgs(target.substring(query + 1));
+
+  // Keep only the headers a handler asked for
+  headers.clear();
+  bool formBody = false;
+  int pos = lineEnd + 2;
+  while (pos < conn.headerEnd - 2) {
+    int next = conn.request.indexOf("\r\n", pos);
+    int colon = conn.request.indexOf(':', pos);
+    if (colon > pos && colon < next) {
+      String name = conn.request.substring(pos, colon);
+      String value = conn.request.substring(colon + 1, next);
+      value.trim();
+      if (name.equalsIgnoreCase("Content-Type")) {
+        formBody = value.startsWith("application/x-www-form-urlencoded");
+      }
+      for (const auto& key : headerKeys) {
+        if (name.equalsIgnoreCase(key)) headers.push_back({ key, value });
+      }
+    }
+    pos = next + 2;
+  }
+
+  if (formBody && conn.contentLength > 0) {
+    parseArgs(conn.request.substring(conn.headerEnd, conn.headerEnd + conn.contentLength));
+  }
+  return true;
+}
+
+void HubHttpServer::parseArgs(const String& encoded) {
+  int start = 0;
+  while (start < (int)encoded.length()) {
+    int amp = encoded.indexOf('&', start);
+    if (amp < 0) amp = encoded.length();
+    int eq = encoded.indexOf('=', start);
+    if (eq < 0 || eq > amp) eq = amp;
+
+    String name = urlDecode(encoded.substring(start, eq));
+    String value = eq < amp ? urlDecode(encoded.substring(eq + 1, amp)) : String();
+    if (name.length() > 0) args.push_back({ name, value });
+    start = amp + 1;
+  }
+}
+
+void HubHttpServer::dispatch(HttpConnection& conn) {
+  requestCount++;
+  if (!parseRequest(conn)) {
+    reply(conn, 400, "Bad request");
+    return;
+  }
+
+  current = &conn;
+  responseHeaders = "";
+  responseLength = 0;
+  headSent = false;
+  detached = false;
+
+  const Route* match = nullptr;
+  for (const auto& route : routes) {
+    if (route.uri == path && (route.method == HTTP_ANY || route.method == requestMethod)) {
+      match = &route;
+      break;
+    }
+  }
+
+  if (match) {
+    match->handler();
+  } else {
+    send(404, "text/plain", "Not found");
+  }
+
+  if (!detached) {
+    if (conn.chunked && !conn.producer) sendContent("", 0);   // Handler left the chunked body open
+    if (!headSent) send(500, "text/plain", "No response");
+  }
+
+  if (detached) {
+    close(conn);
+  } else {
+    conn.request = "";
+    conn.responding = true;
+    conn.lastWrite = millis();
+  }
+  current = nullptr;
+  args.clear();
+  headers.clear();
+  responseHeaders = "";
+}
+
+void HubHttpServer::reply(HttpConnection& conn, int code, const char* message) {
+  String response = "HTTP/1.1 " + String(code) + " " + statusText(code) + "\r\n";
+  response += "Content-Type: text/plain\r\nConnection: close\r\n";
+  response += "Content-Length: " + String(strlen(message)) + "\r\n\r\n";
+  response += message;
+
+  conn.request = "";
+  conn.out = response;
+  conn.outPos = 0;
+  conn.responding = true;
+  conn.lastWrite = millis();
+  flushResponse(conn);
+}
+
+// Appends to the current response without waiting. Past HTTP_MAX_QUEUED,
+// or if the heap can't take it, the response is abandoned: a body missing a
+// piece would be worse than none.
+void HubHttpServer::queue(const char* data, size_t length) {
+  HttpConnection& conn = *current;
+  if (conn.failed) return;
+  if (conn.out.length() - conn.outPos + length > HTTP_MAX_QUEUED) {
+    conn.failed = true;
+    abandonedCount++;
+    return;
+  }
+
+  if (conn.outPos > 0 && conn.outPos >= conn.out.length() / 2) {
+    conn.out.remove(0, conn.outPos);
+    for (uint8_t i = 0; i < conn.flashRuns; i++) {
+      conn.flash[i].at -= conn.outPos;
+    }
+    conn.outPos = 0;
+  }
+  if (!conn.out.concat(data, length)) {
+    conn.failed = true;
+    abandonedCount++;
+  }
+}
+
+// Queues a flash fragment by address; it costs no heap. With every run
+// taken it is copied like generated output.
+void HubHttpServer::queueFlash(PGM_P data, size_t length) {
+  HttpConnection& conn = *current;
+  if (conn.failed || length == 0) return;
+  if (conn.flashRuns == HTTP_FLASH_RUNS) {
+    queue(data, length);
+    return;
+  }
+  conn.flash[conn.flashRuns++] = { conn.out.length(), (const uint8_t*)data, length };
+}
+
+// Runs one part of a streamed body, closing it once the producer is done
+void HubHttpServer::resume(HttpConnection& conn) {
+  current = &conn;
+  headSent = true;
+  bool more;
+  {
+    ChunkWriter out(*this);
+    more = conn.producer(out);
+  }
+  if (!more) {
+    conn.producer = nullptr;
+    if (conn.chunked) sendContent("", 0);
+  }
+  current = nullptr;
+}
+
+// Sends whatever the socket takes without blocking, taking each flash run
+// once out has been sent up to it
+void HubHttpServer::writePending(HttpConnection& conn) {
+  int fd = conn.client.fd();
+  while (!conn.failed) {
+    bool fromFlash = conn.flashRuns > 0 && conn.outPos == conn.flash[0].at;
+    size_t outEnd = conn.flashRuns > 0 ? conn.flash[0].at : conn.out.length();
+    const uint8_t* data = fromFlash ? conn.flash[0].data : (const uint8_t*)conn.out.c_str() + conn.outPos;
+    size_t length = fromFlash ? conn.flash[0].left : outEnd - conn.outPos;
+    if (length == 0) return;
+
+    int n = ::send(fd, data, length, MSG_DONTWAIT);
+    if (n < 0) {
+      conn.failed = (errno != EAGAIN && errno != EWOULDBLOCK);
+      return;
+    }
+    conn.lastWrite = millis();
+    if (fromFlash) {
+      conn.flash[0].data += n;
+      conn.flash[0].left -= n;
+      if (conn.flash[0].left == 0) {
+        conn.flashRuns--;
+        memmove(conn.flash, conn.flash + 1, conn.flashRuns * sizeof(FlashRun));
+      }
+    } else {
+      conn.outPos += n;
+    }
+    if ((size_t)n < length) return;   // Socket buffer full
+  }
+}
+
+// Runs every pass for a dispatched connection until its response is out
+void HubHttpServer::flushResponse(HttpConnection& conn) {
+  while (conn.producer && !conn.failed && conn.out.length() - conn.outPos < HTTP_RESUME_BELOW) {
+    resume(conn);
+  }
+  writePending(conn);
+  bool done = !conn.producer && conn.outPos == conn.out.length() && conn.flashRuns == 0;
+  if (!done && !conn.failed && millis() - conn.lastWrite > HTTP_WRITE_TIMEOUT_MS) {
+    conn.failed = true;
+    abandonedCount++;
+  }
+  if (done || conn.failed) close(conn);
+}
+
+void HubHttpServer::close(HttpConnection& conn) {
+  if (!(&conn == current && detached)) conn.client.stop();
+  conn.client = WiFiClient();
+  conn.request = "";
+  conn.responding = false;
+  conn.failed = false;
+  conn.chunked = false;
+  conn.producer = nullptr;
+  conn.out = "";
+  conn.outPos = 0;
+  conn.flashRuns = 0;
+  conn.active = false;
+}
+
+bool HubHttpServer::hasArg(const String& name) const {
+  for (const auto& a : args) {
+    if (a.first == name) return true;
+  }
+  return false;
+}
+
+String HubHttpServer::arg(const String& name) const {
+  for (const auto& a : args) {
+    if (a.first == name) return a.second;
+  }
+  return String();
+}
+
+String HubHttpServer::header(const String& name) const {
+  for (const auto& h : headers) {
+    if (h.first.equalsIgnoreCase(name)) return h.second;
+  }
+  return String();
+}
+
+WiFiClient& HubHttpServer::client() {
+  detached = true;
+  return current->client;
+}
+
+void HubHttpServer::sendHeader(const String& name, const String& value) {
+  responseHeaders += name + ": " + value + "\r\n";
+}
+
+void HubHttpServer::sendHead(int code, const char* contentType, size_t length) {
+  String head = "HTTP/1.1 " + String(code) + " " + statusText(code) + "\r\n";
+  if (contentType && *contentType) head += String("Content-Type: ") + contentType + "\r\n";
+  if (length == CONTENT_LENGTH_UNKNOWN) {
+    head += "Transfer-Encoding: chunked\r\n";
+    current->chunked = true;
+  } else {
+    head += "Content-Length: " + String((unsigned long)length) + "\r\n";
+  }
+  head += responseHeaders;
+  head += "Connection: close\r\n\r\n";
+
+  queue(head.c_str(), head.length());
+  headSent = true;
+}
+
+void HubHttpServer::send(int code, const char* contentType, const String& content) {
+  if (!current || headSent) return;
+  sendHead(code, contentType, responseLength == CONTENT_LENGTH_UNKNOWN ? CONTENT_LENGTH_UNKNOWN : content.length());
+  if (content.length() > 0) sendContent(content);
+}
+
+void HubHttpServer::send_P(int code, PGM_P contentType, PGM_P content, size_t length) {
+  if (!current || headSent) return;
+  sendHead(code, contentType, length);
+  queueFlash(content, length);
+}
+
+void HubHttpServer::stream(BodyProducer producer) {
+  if (!current || !current->chunked) return;
+  current->producer = producer;
+}
+
+void HubHttpServer::sendBody(const char* content, size_t length, bool fromFlash) {
+  if (!current || !headSent) return;
+  if (!current->chunked) {
+    if (fromFlash) queueFlash(content, length);
+    else queue(content, length);
+    return;
+  }
+
+  char size[12];
+  snprintf(size, sizeof(size), "%x\r\n", (unsigned)length);
+  queue(size, strlen(size));
+  if (length == 0) {
+    queue("\r\n", 2);   // Last chunk
+    current->chunked = false;
+    return;
+  }
+  if (fromFlash) queueFlash(content, length);
+  else queue(content, length);
+  queue("\r\n", 2);
+}
+
+// -------------------------------------------------------------
+// Web Interface
+// -------------------------------------------------------------
+void setupWebInterface() {
+  // Static dashboard bundle, gzipped in flash
+  for (size_t i = 0; i < DASHBOARD_ASSET_COUNT; i++) {
+    const DashboardAsset& asset = DASHBOARD_ASSETS[i];
+    webServer.on(asset.path, HTTP_GET, [&asset]() { serveAsset(asset); });
+  }
+  webServer.on("/api/stats", HTTP_GET, handleApiStats);
+  webServer.on("/api/rules", HTTP_GET, handleApiRules);
+  webServer.on("/api/devices", HTTP_GET, handleApiDevices);
+  webServer.on("/api/state", HTTP_GET, handleApiState);
+  webServer.on("/api/history", HTTP_GET, handleApiHistory);
+  webServer.on("/api/archive", HTTP_GET, handleApiArchive);
+  webServer.on("/events", HTTP_GET, handleEvents);
+  webServer.on("/metrics", HTTP_GET, handleMetrics);
+  webServer.on("/api/bridge", HTTP_GET, handleApiBridge);
+  webServer.on("/bridge", HTTP_POST, handleBridge);
+  webServer.on("/automations", handleAutomations);
+  webServer.on("/add-rule", HTTP_POST, handleAddRule);
+  webServer.on("/delete-rule", HTTP_POST, handleDeleteRule);
+  webServer.on("/add-alias", HTTP_POST, handleAddAlias);
+  webServer.on("/backtest", HTTP_POST, handleBacktest);
+  webServer.on("/delete-alias", HTTP_POST, handleDeleteAlias);
+  webServer.on("/stats", handleStats);
+  
+  const char* headerKeys[] = { "If-None-Match" };
+  webServer.collectHeaders(headerKeys, 1);
+
+  webServer.begin();
+  Serial.printf("[WEB] Server started on port %d (%d connections)\n", HTTP_PORT, MAX_HTTP_CONNECTIONS);
+}
+
+static int connectedClientCount() {
+  int count = 0;
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (clientConnected[i] && mqttClients[i].connected()) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// Serves a precompressed asset; browsers revalidate with If-None-Match and
+// get an empty 304 until the firmware (and so the ETag) changes.
+void serveAsset(const DashboardAsset& asset) {
+  webServer.sendHeader("ETag", asset.etag);
+  webServer.sendHeader("Cache-Control", "no-cache");
+
+  if (webServer.header("If-None-Match") == asset.etag) {
+    webServer.send(304);
+    return;
+  }
+
+  webServer.sendHeader("Content-Encoding", "gzip");
+  webServer.send_P(200, asset.contentType, (PGM_P)asset.data, asset.length);
+}
+
+static const char AUTOMATIONS_HEAD[] PROGMEM = R"(
+<!DOCTYPE html>
+<html>
+<head>
+  <meta charset="utf-8">
+  <meta name="viewport" content="width=device-width,initial-scale=1">
+  <title>Automations - VeaHub</title>
+  <link rel="stylesheet" href="/app.css">
+</head>
+<body>
+  <div class="container">
+    <h1>📋 Local Automations</h1>
+    <p style="margin-bottom:20px;"><a href="/">← Back to Dashboard</a></p>
+    
+)";
+
+static const char AUTOMATIONS_FORMS[] PROGMEM = R"(
+    <form method="POST" action="/add-alias" style="background:#16213e;padding:20px;border-radius:8px;margin-top:10px;">
+      <p><label>Alias:<br><input type="text" name="name" style="width:100%;padding:8px;margin-top:5px;" placeholder="livingroom"></label></p>
+      <p><label>Device:<br><input type="text" name="device" style="width:100%;padding:8px;margin-top:5px;" placeholder="smartmonitor/1"></label></p>
+      <p><label>Room (optional, defaults to the alias):<br><input type="text" name="room" style="width:100%;padding:8px;margin-top:5px;" placeholder="livingroom"></label></p>
+      <button type="submit" class="btn">Save Alias</button>
+    </form>
+    <h2 style="color:#00d4ff;margin-top:30px;">Add New Rule</h2>
+    <form method="POST" action="/add-rule" style="background:#16213e;padding:20px;border-radius:8px;">
+      <p><label>Source Topic:<br><input type="text" name="source" style="width:100%;padding:8px;margin-top:5px;" placeholder="vealive/smartmonitor/1/telemetry"></label></p>
+      <p><label>Condition (avg/min/max/rate windows up to 5m):<br><input type="text" name="condition" style="width:100%;padding:8px;margin-top:5px;" placeholder="livingroom.temp > 28 AND bedroom.hum > 60"></label></p>
+      <p><label>Target Topic:<br><input type="text" name="target" style="width:100%;padding:8px;margin-top:5px;" placeholder="vealive/smartplug/2/command/state"></label></p>
+      <p><label>Payload:<br><input type="text" name="payload" style="width:100%;padding:8px;margin-top:5px;" placeholder="{&quot;state&quot;:&quot;OFF&quot;}"></label></p>
+      <button type="submit" class="btn">Add Rule</button>
+      <button type="submit" class="btn" formaction="/backtest">Backtest (up to 24h)</button>
+    </form>
+  </div>
+</body>
+</html>
+)";
+
+static void printRuleRow(Print& out, size_t i) {
+  const auto& rule = automationRules[i];
+  out.print("<div class='rule'><div class='rule-header'><div class='rule-condition'>");
+  out.print(rule.condition);
+  out.print("</div><form method='POST' action='/delete-rule' style='display:inline;'>");
+  out.print("<input type='hidden' name='index' value='");
+  out.print((unsigned)i);
+  out.print("'><button type='submit' class='btn-delete'>Delete</button></form></div>");
+  out.print("<div class='rule-action'>If ");
+  out.print(rule.condition);
+  out.print(" then publish to ");
+  out.print(rule.targetTopic);
+  out.print("</div></div>");
+}
+
+static void printAliasRow(Print& out, size_t i) {
+  const auto& alias = deviceAliases[i];
+  out.print("<div class='rule'><div class='rule-header'><div class='rule-condition'>");
+  out.print(alias.name);
+  out.print("</div><form method='POST' action='/delete-alias' style='display:inline;'>");
+  out.print("<input type='hidden' name='index' value='");
+  out.print((unsigned)i);
+  out.print("'><button type='submit' class='btn-delete'>Delete</button></form></div>");
+  out.print("<div class='rule-action'>");
+  out.print(alias.deviceKey);
+  if (alias.room.length() > 0) {
+    out.print(" in ");
+    out.print(alias.room);
+  }
+  out.print("</div></div>");
+}
+
+// Rules and aliases go out one per part as the socket drains
+void handleAutomations() {
+  ChunkWriter out(webServer);
+  out.begin(200, "text/html");
+  out.printP(AUTOMATIONS_HEAD);
+
+  enum { RULES, ALIASES, TAIL } part = RULES;
+  size_t next = 0;
+  webServer.stream([part, next](ChunkWriter& out) mutable {
+    if (part == RULES) {
+      if (next < automationRules.size()) {
+        printRuleRow(out, next++);
+        return true;
+      }
+      out.print("<h2 style='color:#00d4ff;margin-top:30px;margin-bottom:15px;'>Device Aliases</h2>");
+      part = ALIASES;
+      next = 0;
+    }
+    if (part == ALIASES) {
+      if (next < deviceAliases.size()) {
+        printAliasRow(out, next++);
+        return true;
+      }
+      part = TAIL;
+    }
+
+    out.print("<p class='rule-action'>Known devices:");
+    for (uint8_t i = 0; i < deviceCount; i++) {
+      if (!deviceStates[i].key[0]) continue;   // Freed room
+      out.print(' ');
+      out.print(deviceStates[i].key);
+    }
+    out.print("</p>");
+    out.printP(AUTOMATIONS_FORMS);
+    return false;
+  });
+}
+
+void handleAddRule() {
+  AutomationRule rule;
+  rule.enabled = true;
+  rule.sourceTopic = webServer.arg("source");
+  rule.condition = webServer.arg("condition");
+  rule.targetTopic = webServer.arg("target");
+  rule.targetPayload = webServer.arg("payload");
+
+  if (!compileRule(rule)) {
+    webServer.send(400, "text/plain", "Invalid condition: " + rule.condition);
+    return;
+  }
+  
+  automationRules.push_back(std::move(rule));
+  saveAutomationRules();
+  
+  webServer.sendHeader("Location", "/automations");
+  webServer.send(303);
+}
+
+void handleDeleteRule() {
+  int index = webServer.arg("index").toInt();
+  if (index >= 0 && index < automationRules.size()) {
+    automationRules.erase(automationRules.begin() + index);
+    saveAutomationRules();
+  }
+  
+  webServer.sendHeader("Location", "/automations");
+  webServer.send(303);
+}
+
+// Dry-runs a rule over recorded history without saving it
+void handleBacktest() {
+  AutomationRule rule;
+  rule.enabled = true;
+  rule.sourceTopic = webServer.arg("source");
+  rule.condition = webServer.arg("condition");
+
+  if (!compileRule(rule)) {
+    webServer.send(400, "text/plain", "Invalid condition: " + rule.condition);
+    return;
+  }
+  if (rule.unresolved) {
+    webServer.send(400, "text/plain", "Condition names a device or field with no data yet: " + rule.condition);
+    return;
+  }
+
+  long hoursArg = webServer.hasArg("hours") ? webServer.arg("hours").toInt() : MAX_BACKTEST_HOURS;
+  uint32_t hours = constrain(hoursArg, 1L, (long)MAX_BACKTEST_HOURS);
+  uint32_t nowSec = millis() / 1000;
+  uint32_t sinceSec = (hours * 3600 < nowSec) ? nowSec - hours * 3600 : 0;
+
+  std::unique_ptr<BacktestResult> result(new (std::nothrow) BacktestResult());
+  String error;
+  if (!result || !backtestRule(rule, sinceSec, *result, error)) {
+    webServer.send(400, "text/plain", result ? error : String("Out of memory"));
+    return;
+  }
+
+  DynamicJsonDocument doc(1024 + MAX_BACKTEST_TIMESTAMPS * 16);
+  doc["condition"] = rule.condition;
+  doc["hours"] = hours;                    // Requested
+  doc["from"] = result->fromSec;           // Covered, seconds since boot
+  doc["to"] = result->toSec;
+  doc["coveredHours"] = result->evaluated ? (result->toSec - result->fromSec + 60) / 3600.0f : 0.0f;
+  doc["resolutionSec"] = HISTORY_TIERS[TIER_MINUTE].stepSec;
+  doc["evaluated"] = result->evaluated;
+  doc["fired"] = result->fired;
+  doc["episodes"] = result->episodes;
+  doc["elapsedUs"] = result->elapsedUs;
+  doc["now"] = nowSec;
+  JsonArray starts = doc.createNestedArray("episodeStarts");  // Seconds since boot
+  for (uint32_t i = 0; i < result->episodes && i < MAX_BACKTEST_TIMESTAMPS; i++) {
+    starts.add(result->timestamps[i]);
+  }
+
+  String json;
+  serializeJson(doc, json);
+  webServer.send(200, "application/json", json);
+}
+
+void handleAddAlias() {
+  DeviceAlias alias;
+  alias.name = webServer.arg("name");
+  alias.deviceKey = webServer.arg("device");
+  alias.room = webServer.arg("room");
+  alias.room.trim();
+
+  if (alias.name.length() == 0 || alias.deviceKey.length() == 0) {
+    webServer.send(400, "text/plain", "Alias name and device are required");
+    return;
+  }
+
+  for (auto& existing : deviceAliases) {
+    if (existing.name == alias.name) {
+      existing.deviceKey = alias.deviceKey;
+      existing.room = alias.room;
+      alias.name = "";
+      break;
+    }
+  }
+  if (alias.name.length() > 0) {
+    deviceAliases.push_back(alias);
+  }
+  saveDeviceAliases();
+  pruneRooms();
+  recompileRules();
+
+  webServer.sendHeader("Location", "/automations");
+  webServer.send(303);
+}
+
+void handleDeleteAlias() {
+  int index = webServer.arg("index").toInt();
+  if (index >= 0 && index < deviceAliases.size()) {
+    deviceAliases.erase(deviceAliases.begin() + index);
+    saveDeviceAliases();
+    pruneRooms();
+    recompileRules();
+  }
+
+  webServer.sendHeader("Location", "/automations");
+  webServer.send(303);
+}
+
+void handleStats() {
+  int connectedDevices = connectedClientCount();
+
+  ChunkWriter out(webServer);
+  out.begin(200, "text/html");
+  out.print("<html><body style='font-family:system-ui;background:#1a1a2e;color:#eee;padding:20px;'>");
+  out.print("<h1 style='color:#00d4ff;'>Device Statistics</h1>");
+  out.print("<p><a href='/' style='color:#00d4ff;'>← Back</a></p>");
+  out.print("<p><strong>Connected Devices:</strong> ");
+  out.print(connectedDevices);
+  out.print("</p><p><strong>Active Rules:</strong> ");
+  out.print((unsigned)automationRules.size());
+  out.print("</p><p><strong>Uptime:</strong> ");
+  out.print(millis() / 1000);
+  out.print(" seconds</p>");
+  out.print("</body></html>");
+  out.end();
+}
+
+// -------------------------------------------------------------
+// JSON API
+// -------------------------------------------------------------
+// Every response is serialized straight into a ChunkWriter. Lists are streamed
+// one element per part from a small stack document, so memory stays flat as
+// rules and devices grow. Strings are added by pointer, not copied.
+static const uint32_t API_DEFAULT_LIMIT = 20;
+static const uint32_t API_MAX_LIMIT = 50;
+static const uint16_t API_ROWS_PER_PART = 32;   // History points per streamed part
+
+// Fills doc for element i, or returns false to leave it out
+typedef std::function<bool(JsonDocument&, uint32_t)> ElementWriter;
+
+// Streams elements [first, last) as a JSON array, then tail
+static void streamElements(uint32_t first, uint32_t last, const char* tail, ElementWriter element) {
+  uint32_t i = first;
+  bool any = false;
+  webServer.stream([=](ChunkWriter& out) mutable {
+    while (i < last) {
+      StaticJsonDocument<1024> doc;
+      if (!element(doc, i++)) continue;
+      if (any) out.print(',');
+      serializeJson(doc, out);
+      any = true;
+      return true;
+    }
+    out.print(tail);
+    return false;
+  });
+}
+
+static void readPage(uint32_t total, uint32_t& offset, uint32_t& limit) {
+  offset = webServer.hasArg("offset") ? webServer.arg("offset").toInt() : 0;
+  limit = webServer.hasArg("limit") ? webServer.arg("limit").toInt() : API_DEFAULT_LIMIT;
+  if (limit == 0 || limit > API_MAX_LIMIT) limit = API_MAX_LIMIT;
+  if (offset > total) offset = total;
+}
+
+// Accepts a device key ("smartmonitor/1") or an alias
+static uint8_t lookupDevice(const String& name) {
+  for (const auto& alias : deviceAliases) {
+    if (alias.name == name) return findDevice(alias.deviceKey.c_str());
+  }
+  return findDevice(name.c_str());
+}
+
+// GET /api/stats
+void handleApiStats() {
+  String ip = apIP.toString();
+
+  StaticJsonDocument<256> doc;
+  doc["ssid"] = AP_SSID;
+  doc["password"] = AP_PASSWORD;
+  doc["ip"] = ip.c_str();
+  doc["mqttPort"] = MQTT_PORT;
+  doc["clients"] = connectedClientCount();
+  doc["rules"] = automationRules.size();
+  doc["devices"] = deviceCount;
+  doc["uptime"] = millis() / 1000;
+  doc["freeHeap"] = ESP.getFreeHeap();
+  doc["eventDrops"] = eventDrops;
+
+  ChunkWriter out(webServer);
+  out.begin(200, "application/json");
+  serializeJson(doc, out);
+  out.end();
+}
+
+// GET /api/rules?offset=0&limit=20
+void handleApiRules() {
+  uint32_t total = automationRules.size();
+  uint32_t offset, limit;
+  readPage(total, offset, limit);
+  uint32_t last = min(total, offset + limit);
+
+  ChunkWriter out(webServer);
+  out.begin(200, "application/json");
+  out.print("{\"total\":");
+  out.print(total);
+  out.print(",\"offset\":");
+  out.print(offset);
+  out.print(",\"limit\":");
+  out.print(limit);
+  out.print(",\"rules\":[");
+
+  streamElements(offset, last, "]}", [](JsonDocument& doc, uint32_t i) {
+    if (i >= automationRules.size()) return false;   // Deleted meanwhile
+    const auto& rule = automationRules[i];
+    doc["index"] = i;
+    doc["enabled"] = rule.enabled;
+    doc["source"] = rule.sourceTopic.c_str();
+    doc["condition"] = rule.condition.c_str();
+    doc["target"] = rule.targetTopic.c_str();
+    doc["payload"] = rule.targetPayload.c_str();
+    doc["unresolved"] = rule.unresolved;
+    JsonArray devices = doc.createNestedArray("devices");
+    for (uint8_t d = 0; d < deviceCount; d++) {
+      if (rule.deviceMask & (1UL << d)) devices.add((const char*)deviceStates[d].key);
+    }
+    return true;
+  });
+}
+
+// GET /api/devices[?device=key-or-alias]
+void handleApiDevices() {
+  uint8_t only = NO_ID;
+  if (webServer.hasArg("device")) {
+    only = lookupDevice(webServer.arg("device"));
+    if (only == NO_ID) {
+      webServer.send(404, "application/json", "{\"error\":\"unknown device\"}");
+      return;
+    }
+  }
+
+  ChunkWriter out(webServer);
+  out.begin(200, "application/json");
+  out.print("{\"devices\":[");
+
+  streamElements(0, deviceCount, "]}", [only](JsonDocument& doc, uint32_t d) {
+    if ((only != NO_ID && d != only) || !deviceStates[d].key[0]) return false;
+    uint32_t now = millis();
+    const DeviceState& state = deviceStates[d];
+    const DeviceRecord& record = deviceRecords[d];
+    doc["key"] = (const char*)state.key;
+    doc["online"] = record.online;
+    if (record.slot != NO_ID) doc["slot"] = record.slot;
+    doc["connects"] = record.connects;
+    doc["messages"] = record.messages;
+    doc["ratePerMin"] = record.rate;
+    doc["firstSeenAgo"] = (now - record.firstSeen) / 1000;
+    if (record.fw[0]) doc["fw"] = (const char*)record.fw;
+    if (state.presentMask & (1UL << FIELD_RSSI)) doc["rssi"] = state.values[FIELD_RSSI];
+    JsonArray caps = doc.createNestedArray("caps");
+    if (record.caps & CAP_TELEMETRY) caps.add("telemetry");
+    if (record.caps & CAP_STATUS) caps.add("status");
+    if (record.caps & CAP_THRESHOLDS) caps.add("thresholds");
+    JsonArray aliases = doc.createNestedArray("aliases");
+    for (const auto& alias : deviceAliases) {
+      if (alias.deviceKey == state.key) aliases.add(alias.name.c_str());
+    }
+    if (state.lastSeen) doc["lastSeenAgo"] = (now - state.lastSeen) / 1000;
+    JsonArray fields = doc.createNestedArray("fields");
+    for (uint8_t f = 0; f < fieldCount; f++) {
+      if (state.presentMask & (1UL << f)) fields.add((const char*)fieldNames[f]);
+    }
+    return true;
+  });
+}
+
+// GET /api/state[?device=key-or-alias]
+void handleApiState() {
+  uint8_t only = NO_ID;
+  if (webServer.hasArg("device")) {
+    only = lookupDevice(webServer.arg("device"));
+    if (only == NO_ID) {
+      webServer.send(404, "application/json", "{\"error\":\"unknown device\"}");
+      return;
+    }
+  }
+
+  ChunkWriter out(webServer);
+  out.begin(200, "application/json");
+  out.print("{\"devices\":[");
+
+  streamElements(0, deviceCount, "]}", [only](JsonDocument& doc, uint32_t d) {
+    if ((only != NO_ID && d != only) || !deviceStates[d].key[0]) return false;
+    uint32_t now = millis();
+    const DeviceState& state = deviceStates[d];
+    doc["key"] = (const char*)state.key;
+    if (state.lastSeen) doc["lastSeenAgo"] = (now - state.lastSeen) / 1000;
+    JsonObject values = doc.createNestedObject("values");
+    for (uint8_t f = 0; f < fieldCount; f++) {
+      if (state.presentMask & (1UL << f)) values[(const char*)fieldNames[f]] = state.values[f];
+    }
+    return true;
+  });
+}
+
+// GET /api/history?device=livingroom&field=temp&from=&to=&res=raw|1m|1h
+// Times are seconds since boot ("now" is included to convert). Without res,
+// the finest tier that still reaches back to "from" is used. Each point is
+// [bucketStart, min, max, mean]; the still-open bucket comes last.
+static int historyField(const String& name) {
+  for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+    if (name == fieldNames[f]) return f;
+  }
+  return -1;
+}
+
+void handleApiHistory() {
+  uint8_t device = lookupDevice(webServer.arg("device"));
+  if (device == NO_ID || !deviceHistory[device].allocated) {
+    webServer.send(404, "application/json", "{\"error\":\"no history for device\"}");
+    return;
+  }
+
+  int field = historyField(webServer.arg("field"));
+  if (field < 0) {
+    webServer.send(400, "application/json", "{\"error\":\"field must be temp, hum, dust, mq2, alertFlags or rssi\"}");
+    return;
+  }
+
+  uint32_t now = millis() / 1000;
+  uint32_t to = webServer.hasArg("to") ? webServer.arg("to").toInt() : now;
+  uint32_t from = webServer.hasArg("from") ? webServer.arg("from").toInt() : (now > 3600 ? now - 3600 : 0);
+
+  const DeviceHistory& h = deviceHistory[device];
+  int tierId = -1;
+  String res = webServer.arg("res");
+  for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+    if (res == HISTORY_TIERS[t].name) tierId = t;
+  }
+  if (tierId < 0) {
+    tierId = TIER_HOUR;
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+      const HistoryTier& tier = h.tiers[t];
+      bool full = tier.count == tier.slots;
+      if (!full || tier.rowStart(0) <= from) {
+        tierId = t;
+        break;
+      }
+    }
+  }
+
+  ChunkWriter out(webServer);
+  out.begin(200, "application/json");
+  out.printf("{\"device\":\"%s\",\"field\":\"%s\",\"res\":\"%s\",\"step\":%u,\"now\":%u,\"points\":[",
+             deviceStates[device].key, fieldNames[field], HISTORY_TIERS[tierId].name,
+             (unsigned)HISTORY_TIERS[tierId].stepSec, (unsigned)now);
+
+  // The ring may move on between parts, so the place is kept as a time
+  uint32_t cursor = from;
+  bool first = true;
+  webServer.stream([=](ChunkWriter& out) mutable {
+    const HistoryTier& tier = deviceHistory[device].tiers[tierId];
+    uint16_t i = firstRowFrom(tier, cursor);
+    for (uint16_t n = 0; n < API_ROWS_PER_PART && i < tier.count && tier.rowStart(i) <= to; n++, i++) {
+      uint32_t start = tier.rowStart(i);
+      cursor = start + 1;
+      const HistoryBucket& b = tier.row(i)[field];
+      if (isnan(b.mean)) continue;
+      out.printf("%s[%u,%.2f,%.2f,%.2f]", first ? "" : ",", (unsigned)start, b.min, b.max, b.mean);
+      first = false;
+    }
+    if (i < tier.count && tier.rowStart(i) <= to) return true;
+
+    HistoryBucket open;
+    if (tier.openStart >= cursor && tier.openStart <= to && openBucket(tier, field, open)) {
+      out.printf("%s[%u,%.2f,%.2f,%.2f]", first ? "" : ",", (unsigned)tier.openStart, open.min, open.max, open.mean);
+    }
+    out.print("]}");
+    return false;
+  });
+}
+
+// -------------------------------------------------------------
+// Event Stream (SSE)
+// -------------------------------------------------------------
+// MQTT topic filter match with + (one level) and # (rest of topic)
+static bool topicMatches(const String& filter, const String& topic) {
+  const char* f = filter.c_str();
+  const char* t = topic.c_str();
+
+  while (*f) {
+    if (*f == '#') return true;
+    if (*f == '+') {
+      while (*t && *t != '/') t++;
+      f++;
+    } else {
+      if (*f != *t) return false;
+      f++;
+      t++;
+    }
+  }
+  return *t == '\0';
+}
+
+static bool listenerWants(const EventListener& listener, const String& topic) {
+  if (listener.filterCount == 0) return true;
+  for (uint8_t i = 0; i < listener.filterCount; i++) {
+    if (topicMatches(listener.filters[i], topic)) return true;
+  }
+  return false;
+}
+
+static void appendJsonString(String& out, const String& value) {
+  out += '"';
+  for (size_t i = 0; i < value.length(); i++) {
+    char c = value[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((uint8_t)c < 0x20) {
+      out += ' ';
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+// Encodes a routed message once for all listeners
+void publishEvent(const String& topic, const String& payload) {
+  bool listening = false;
+  for (int i = 0; i < MAX_EVENT_LISTENERS; i++) {
+    listening |= eventListeners[i].active;
+  }
+  if (!listening) return;
+
+  StreamEvent& event = eventRing[eventHead % EVENT_RING_SIZE];
+  event.topic = topic;
+
+  // JSON payloads are embedded as-is, anything else as a string
+  String& frame = event.frame;
+  frame = "id: ";
+  frame += eventHead;
+  frame += "\ndata: {\"topic\":";
+  appendJsonString(frame, topic);
+  frame += ",\"payload\":";
+  if (payload.startsWith("{") || payload.startsWith("[")) {
+    frame += payload;
+  } else {
+    appendJsonString(frame, payload);
+  }
+  frame += "}\n\n";
+
+  eventHead++;
+}
+
+static void closeListener(int slot) {
+  EventListener& listener = eventListeners[slot];
+  listener.client.stop();
+  listener.active = false;
+  Serial.printf("[SSE] Listener %d closed (%u dropped)\n", slot, listener.dropped);
+}
+
+// Writes whatever each socket accepts without blocking; the rest waits for the next loop
+void pumpEventStreams() {
+  uint32_t now = millis();
+
+  for (int i = 0; i < MAX_EVENT_LISTENERS; i++) {
+    EventListener& listener = eventListeners[i];
+    if (!listener.active) continue;
+    if (!listener.client.connected()) {
+      closeListener(i);
+      continue;
+    }
+
+    // Drop oldest frames once the listener is too far behind
+    if (listener.sent == 0 && eventHead - listener.cursor > EVENT_BACKLOG) {
+      uint32_t skipped = eventHead - EVENT_BACKLOG - listener.cursor;
+      listener.dropped += skipped;
+      eventDrops += skipped;
+      listener.cursor = eventHead - EVENT_BACKLOG;
+    }
+    // The frame being written was overwritten; the stream can't be resumed
+    if (eventHead - listener.cursor >= EVENT_RING_SIZE) {
+      closeListener(i);
+      continue;
+    }
+
+    int fd = listener.client.fd();
+    bool failed = false;
+    while (listener.cursor != eventHead) {
+      const StreamEvent& event = eventRing[listener.cursor % EVENT_RING_SIZE];
+      if (listener.sent == 0 && !listenerWants(listener, event.topic)) {
+        listener.cursor++;
+        continue;
+      }
+
+      int n = send(fd, event.frame.c_str() + listener.sent, event.frame.length() - listener.sent, MSG_DONTWAIT);
+      if (n < 0) {
+        failed = (errno != EAGAIN && errno != EWOULDBLOCK);
+        break;
+      }
+      listener.sent += n;
+      listener.lastWrite = now;
+      if (listener.sent < event.frame.length()) break;   // Socket buffer full
+
+      listener.sent = 0;
+      listener.cursor++;
+    }
+
+    // Comment line keeps idle connections (and proxies) alive and detects dead peers
+    if (!failed && listener.sent == 0 && now - listener.lastWrite > EVENT_HEARTBEAT_MS) {
+      static const char PING[] = ": ping\n\n";
+      int n = send(fd, PING, sizeof(PING) - 1, MSG_DONTWAIT);
+      if (n == sizeof(PING) - 1) {
+        listener.lastWrite = now;
+      } else if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        failed = true;
+      }
+    }
+
+    if (failed) closeListener(i);
+  }
+}
+
+// GET /events?topic=vealive/+/telemetry,vealive/smartplug/#
+// Takes over the connection; pumpEventStreams() feeds it from then on.
+void handleEvents() {
+  int slot = -1;
+  for (int i = 0; i < MAX_EVENT_LISTENERS; i++) {
+    if (!eventListeners[i].active) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    webServer.send(503, "text/plain", "Too many event streams");
+    return;
+  }
+
+  EventListener& listener = eventListeners[slot];
+  listener.filterCount = 0;
+  String filters = webServer.arg("topic");
+  while (filters.length() > 0 && listener.filterCount < MAX_EVENT_FILTERS) {
+    int comma = filters.indexOf(',');
+    String filter = comma < 0 ? filters : filters.substring(0, comma);
+    filters = comma < 0 ? String() : filters.substring(comma + 1);
+    filter.trim();
+    if (filter.length() > 0) listener.filters[listener.filterCount++] = filter;
+  }
+
+  listener.client = webServer.client();
+  listener.client.print("HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/event-stream\r\n"
+                        "Cache-Control: no-cache\r\n"
+                        "Connection: keep-alive\r\n"
+                        "Access-Control-Allow-Origin: *\r\n\r\n"
+                        "retry: 2000\n\n");
+  listener.cursor = eventHead;
+  listener.sent = 0;
+  listener.lastWrite = millis();
+  listener.dropped = 0;
+  listener.active = true;
+
+  Serial.printf("[SSE] Listener %d opened (%u filters)\n", slot, listener.filterCount);
+}
+
+// -------------------------------------------------------------
+// Spool Compression
+// -------------------------------------------------------------
+// Byte-oriented LZ77 sized for spool batches. Control byte 0LLLLLLL is a run of
+// L+1 literals; 1LLLLLOO plus one byte is a match of L+3 bytes at distance
+// OO:byte + 1 (up to 1 KB back). Telemetry repeats its keys every record, so
+// batches typically shrink 3-4x.
+static const int LZ_HASH_BITS = 10;
+static const size_t LZ_MAX_MATCH = 34;
+static const size_t LZ_MAX_DISTANCE = 1024;
+
+static uint16_t lzHash[1 << LZ_HASH_BITS];
+static uint8_t lzOut[SPOOL_BATCH_BYTES + SPOOL_BATCH_BYTES / 128 + 16];
+
+// Returns the compressed size, or 0 if it would not fit in cap
+static size_t lzCompress(const uint8_t* in, size_t n, uint8_t* out, size_t cap) {
+  for (size_t i = 0; i < (1 << LZ_HASH_BITS); i++) lzHash[i] = 0xFFFF;
+
+  size_t ip = 0, op = 0, literals = 0;
+  auto flushLiterals = [&](size_t end) {
+    while (literals < end) {
+      size_t run = min(end - literals, (size_t)128);
+      if (op + 1 + run > cap) return false;
+      out[op++] = run - 1;
+      memcpy(out + op, in + literals, run);
+      op += run;
+      literals += run;
+    }
+    return true;
+  };
+
+  while (ip + 3 <= n) {
+    uint32_t key = (in[ip] << 16) | (in[ip + 1] << 8) | in[ip + 2];
+    uint32_t h = (uint32_t)(key * 2654435761u) >> (32 - LZ_HASH_BITS);
+    uint16_t candidate = lzHash[h];
+    lzHash[h] = ip;
+
+    if (candidate != 0xFFFF && ip - candidate <= LZ_MAX_DISTANCE && memcmp(in + candidate, in + ip, 3) == 0) {
+      size_t len = 3;
+      while (len < LZ_MAX_MATCH && ip + len < n && in[candidate + len] == in[ip + len]) len++;
+
+      if (!flushLiterals(ip) || op + 2 > cap) return 0;
+      size_t distance = ip - candidate - 1;
+      out[op++] = 0x80 | ((len - 3) << 2) | (distance >> 8);
+      out[op++] = distance & 0xFF;
+      ip += len;
+      literals = ip;
+    } else {
+      ip++;
+    }
+  }
+
+  if (!flushLiterals(n)) return 0;
+  return op;
+}
+
+// Returns the decompressed size, or 0 on corrupt input
+static size_t lzDecompress(const uint8_t* in, size_t n, uint8_t* out, size_t cap) {
+  size_t ip = 0, op = 0;
+  while (ip < n) {
+    uint8_t c = in[ip++];
+    if (c < 0x80) {
+      size_t run = c + 1;
+      if (ip + run > n || op + run > cap) return 0;
+      memcpy(out + op, in + ip, run);
+      ip += run;
+      op += run;
+    } else {
+      if (ip >= n) return 0;
+      size_t len = ((c >> 2) & 0x1F) + 3;
+      size_t distance = (((c & 0x03) << 8) | in[ip++]) + 1;
+      if (distance > op || op + len > cap) return 0;
+      for (size_t k = 0; k < len; k++) out[op + k] = out[op - distance + k];
+      op += len;
+    }
+  }
+  return op;
+}
+
+// -------------------------------------------------------------
+// Cloud Bridge
+// -------------------------------------------------------------
+// Spool file: "VB1" | flags | bootId (4) | rawLen (2) | records (2) | LZ data
+// Record:     timestamp (4) | flags | topicLen (1) | topic | payloadLen (2) | payload
+static const uint8_t SPOOL_MAGIC[3] = { 'V', 'B', '1' };
+static const size_t SPOOL_HEADER_BYTES = 12;
+static const uint8_t RECORD_EPOCH = 0x01;   // Timestamp is Unix time, else seconds since boot
+
+static bool clockSynced() {
+  return time(nullptr) > 1600000000;
+}
+
+static String spoolPath(uint32_t seq) {
+  char path[24];
+  snprintf(path, sizeof(path), "%s/%08lu", SPOOL_DIR, (unsigned long)seq);
+  return String(path);
+}
+
+static void parseBridgeTopics() {
+  bridgeConfig.filterCount = 0;
+  String topics = bridgeConfig.topics;
+  while (topics.length() > 0 && bridgeConfig.filterCount < MAX_BRIDGE_FILTERS) {
+    int comma = topics.indexOf(',');
+    String filter = comma < 0 ? topics : topics.substring(0, comma);
+    topics = comma < 0 ? String() : topics.substring(comma + 1);
+    filter.trim();
+    if (filter.length() > 0) bridgeConfig.filters[bridgeConfig.filterCount++] = filter;
+  }
+}
+
+static bool bridgeWants(const String& topic) {
+  for (uint8_t i = 0; i < bridgeConfig.filterCount; i++) {
+    if (topicMatches(bridgeConfig.filters[i], topic)) return true;
+  }
+  return false;
+}
+
+// Finds the spooled batch range left over from before a reboot
+static void scanSpool() {
+  File dir = LittleFS.open(SPOOL_DIR);
+  if (!dir || !dir.isDirectory()) {
+    LittleFS.mkdir(SPOOL_DIR);
+    return;
+  }
+
+  bool any = false;
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    const char* name = strrchr(f.name(), '/');
+    uint32_t seq = strtoul(name ? name + 1 : f.name(), nullptr, 10);
+    bridge.spoolBytes += f.size();
+    if (!any || seq < bridge.oldestSeq) bridge.oldestSeq = seq;
+    if (!any || seq >= bridge.nextSeq) bridge.nextSeq = seq + 1;
+    any = true;
+  }
+}
+
+// Records left in the drain buffer from drainPos on
+static uint16_t drainRecordsLeft() {
+  uint16_t count = 0;
+  size_t pos = bridge.drainPos;
+  while (pos + 8 <= bridge.drainLen) {
+    uint8_t topicLen = bridge.drain[pos + 5];
+    uint16_t payloadLen;
+    memcpy(&payloadLen, bridge.drain + pos + 6 + topicLen, 2);
+    pos += 8 + topicLen + payloadLen;
+    count++;
+  }
+  return count;
+}
+
+// Evicts the oldest spool file. If it is the one being replayed, the drain
+// stops with it; otherwise finishing the drain would delete the next batch.
+static void dropOldestBatch() {
+  String path = spoolPath(bridge.oldestSeq);
+  File f = LittleFS.open(path, FILE_READ);
+  if (f) {
+    uint8_t header[SPOOL_HEADER_BYTES];
+    uint16_t records = 0;
+    if (f.read(header, sizeof(header)) == sizeof(header)) memcpy(&records, header + 10, 2);
+    bridge.spoolBytes -= min(bridge.spoolBytes, (size_t)f.size());
+    f.close();
+
+    if (bridge.draining && bridge.drainSeq == bridge.oldestSeq) {
+      records = drainRecordsLeft();
+      bridge.draining = false;
+      bridge.drainPos = 0;
+      bridge.drainLen = 0;
+      bridge.drainAttempts = 0;
+    }
+    bridge.dropped += records;
+  }
+  LittleFS.remove(path);
+  bridge.oldestSeq++;
+}
+
+// Compresses the staged batch into a new spool file
+static void closeBatch() {
+  if (bridge.batchRecords == 0) return;
+
+  size_t compressed = lzCompress(bridge.batch, bridge.batchLen, lzOut, sizeof(lzOut));
+  if (compressed == 0 || !bridge.fsReady) {
+    bridge.dropped += bridge.batchRecords;
+  } else {
+    while (bridge.oldestSeq < bridge.nextSeq && bridge.spoolBytes + compressed + SPOOL_HEADER_BYTES > SPOOL_MAX_BYTES) {
+      Serial.println("[BRIDGE] Spool full, dropping oldest batch");
+      dropOldestBatch();
+    }
+
+    uint8_t header[SPOOL_HEADER_BYTES] = { SPOOL_MAGIC[0], SPOOL_MAGIC[1], SPOOL_MAGIC[2], 0 };
+    memcpy(header + 4, &bridge.bootId, 4);
+    uint16_t rawLen = bridge.batchLen;
+    memcpy(header + 8, &rawLen, 2);
+    memcpy(header + 10, &bridge.batchRecords, 2);
+
+    File f = LittleFS.open(spoolPath(bridge.nextSeq), FILE_WRITE);
+    if (f && f.write(header, sizeof(header)) == sizeof(header) && f.write(lzOut, compressed) == compressed) {
+      bridge.spoolBytes += sizeof(header) + compressed;
+      bridge.nextSeq++;
+      Serial.printf("[BRIDGE] Spooled %u messages (%u -> %u bytes)\n",
+                    bridge.batchRecords, (unsigned)bridge.batchLen, (unsigned)compressed);
+    } else {
+      bridge.dropped += bridge.batchRecords;
+    }
+    if (f) f.close();
+  }
+
+  bridge.batchLen = 0;
+  bridge.batchRecords = 0;
+}
+
+static void spoolMessage(const String& topic, const String& payload) {
+  size_t need = 4 + 1 + 1 + topic.length() + 2 + payload.length();
+  if (topic.length() > 255 || need > SPOOL_BATCH_BYTES) {
+    bridge.dropped++;
+    return;
+  }
+  if (bridge.batchLen + need > SPOOL_BATCH_BYTES) closeBatch();
+  if (bridge.batchRecords == 0) bridge.batchStarted = millis();
+
+  bool epoch = clockSynced();
+  uint32_t ts = epoch ? (uint32_t)time(nullptr) : millis() / 1000;
+  uint16_t payloadLen = payload.length();
+
+  uint8_t* p = bridge.batch + bridge.batchLen;
+  memcpy(p, &ts, 4);
+  p[4] = epoch ? RECORD_EPOCH : 0;
+  p[5] = topic.length();
+  memcpy(p + 6, topic.c_str(), topic.length());
+  p += 6 + topic.length();
+  memcpy(p, &payloadLen, 2);
+  memcpy(p + 2, payload.c_str(), payloadLen);
+
+  bridge.batchLen += need;
+  bridge.batchRecords++;
+  bridge.spooled++;
+}
+
+// Republishes a message live, or spools it if the cloud is unreachable
+void bridgeForward(const String& topic, const String& payload) {
+  if (!bridgeConfig.enabled || !bridgeWants(topic)) return;
+
+  if (cloud.connected() && cloud.publish(topic.c_str(), payload.c_str())) {
+    bridge.forwarded++;
+    return;
+  }
+  spoolMessage(topic, payload);
+}
+
+// Loads the oldest spool file into the drain buffer
+static bool loadOldestBatch() {
+  while (bridge.oldestSeq < bridge.nextSeq) {
+    String path = spoolPath(bridge.oldestSeq);
+    File f = LittleFS.open(path, FILE_READ);
+    if (f) {
+      size_t size = f.size();
+      uint8_t header[SPOOL_HEADER_BYTES];
+      bool ok = size > SPOOL_HEADER_BYTES && size - SPOOL_HEADER_BYTES <= sizeof(lzOut) &&
+                f.read(header, sizeof(header)) == sizeof(header) && memcmp(header, SPOOL_MAGIC, 3) == 0 &&
+                f.read(lzOut, size - SPOOL_HEADER_BYTES) == size - SPOOL_HEADER_BYTES;
+      f.close();
+
+      uint16_t rawLen = 0;
+      if (ok) {
+        memcpy(&bridge.drainBootId, header + 4, 4);
+        memcpy(&rawLen, header + 8, 2);
+        bridge.drainLen = lzDecompress(lzOut, size - SPOOL_HEADER_BYTES, bridge.drain, sizeof(bridge.drain));
+        ok = bridge.drainLen == rawLen;
+      }
+      if (ok) {
+        bridge.drainPos = 0;
+        bridge.drainFileSize = size;
+        bridge.drainSeq = bridge.oldestSeq;
+        bridge.drainAttempts = 0;
+        bridge.draining = true;
+        return true;
+      }
+    }
+
+    Serial.printf("[BRIDGE] Discarding unreadable spool batch %lu\n", (unsigned long)bridge.oldestSeq);
+    dropOldestBatch();
+  }
+  return false;
+}
+
+// Publishes one spooled record, stamping JSON payloads with when they were
+// captured. A record refused while the connection stays up (e.g. larger than
+// the client buffer once stamped) is dropped after a few tries rather than
+// holding back the rest of the backlog. False means stop for this pass.
+static bool replayRecord() {
+  const uint8_t* p = bridge.drain + bridge.drainPos;
+  uint32_t ts;
+  uint16_t payloadLen;
+  memcpy(&ts, p, 4);
+  uint8_t flags = p[4];
+  uint8_t topicLen = p[5];
+  memcpy(&payloadLen, p + 6 + topicLen, 2);
+
+  String topic;
+  topic.concat((const char*)p + 6, topicLen);
+  const char* payload = (const char*)p + 8 + topicLen;
+
+  // Seconds-since-boot stamps can only be converted within the same boot
+  int64_t epoch = -1;
+  if (flags & RECORD_EPOCH) {
+    epoch = ts;
+  } else if (bridge.drainBootId == bridge.bootId && clockSynced()) {
+    epoch = (int64_t)time(nullptr) - (millis() / 1000 - ts);
+  }
+
+  String out;
+  out.reserve(payloadLen + 40);
+  if (payloadLen >= 2 && payload[0] == '{' && epoch >= 0) {
+    out = "{\"ts\":";
+    out += String((unsigned long)epoch);
+    out += ",\"spooled\":true";
+    if (payload[1] != '}') out += ',';
+    out.concat(payload + 1, payloadLen - 1);
+  } else {
+    out.concat(payload, payloadLen);
+  }
+
+  size_t recordLen = 8 + topicLen + payloadLen;
+  if (cloud.publish(topic.c_str(), out.c_str())) {
+    bridge.drainPos += recordLen;
+    bridge.drainAttempts = 0;
+    bridge.replayed++;
+    return true;
+  }
+
+  if (!cloud.connected()) return false;   // Outage: retried after reconnecting
+  if (++bridge.drainAttempts < BRIDGE_RECORD_ATTEMPTS) return false;
+
+  Serial.printf("[BRIDGE] Dropping spooled %s message (%u bytes), refused %u times\n",
+                topic.c_str(), (unsigned)out.length(), BRIDGE_RECORD_ATTEMPTS);
+  bridge.drainPos += recordLen;
+  bridge.drainAttempts = 0;
+  bridge.dropped++;
+  return true;
+}
+
+static void drainSpool() {
+  uint32_t now = millis();
+  bridge.tokens = min(BRIDGE_DRAIN_BURST, bridge.tokens + (now - bridge.lastRefill) * BRIDGE_DRAIN_PER_SEC / 1000.0f);
+  bridge.lastRefill = now;
+
+  while (bridge.tokens >= 1) {
+    if (!bridge.draining && !loadOldestBatch()) return;
+
+    if (bridge.drainPos >= bridge.drainLen) {
+      LittleFS.remove(spoolPath(bridge.drainSeq));
+      bridge.spoolBytes -= min(bridge.spoolBytes, bridge.drainFileSize);
+      if (bridge.drainSeq == bridge.oldestSeq) bridge.oldestSeq++;
+      bridge.draining = false;
+      continue;
+    }
+
+    if (!replayRecord()) return;   // Retried on the next pass
+    bridge.tokens -= 1;
+  }
+}
+
+// Backoff with jitter, so hubs recovering from the same outage spread out
+static void scheduleReconnect(bool failed) {
+  if (failed) {
+    bridge.backoffMs = min(bridge.backoffMs * 2, BRIDGE_BACKOFF_MAX_MS);
+  } else {
+    bridge.backoffMs = BRIDGE_BACKOFF_MIN_MS;
+  }
+  bridge.nextAttempt = millis() + bridge.backoffMs / 2 + esp_random() % bridge.backoffMs;
+}
+
+// Starts a non-blocking TCP connect to the broker
+static bool startCloudSocket() {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) return false;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(CLOUD_BROKER_PORT);
+  addr.sin_addr.s_addr = inet_addr(CLOUD_BROKER_HOST);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+    ::close(fd);
+    return false;
+  }
+  bridge.connectFd = fd;
+  bridge.connectStarted = millis();
+  return true;
+}
+
+// 1 once the handshake completed, 0 while pending, -1 on failure or timeout
+static int pollCloudSocket() {
+  int fd = bridge.connectFd;
+  fd_set writable;
+  FD_ZERO(&writable);
+  FD_SET(fd, &writable);
+  struct timeval tv = { 0, 0 };
+
+  if (select(fd + 1, nullptr, &writable, nullptr, &tv) > 0) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err == 0) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      return 1;
+    }
+  } else if (millis() - bridge.connectStarted < BRIDGE_CONNECT_TIMEOUT_MS) {
+    return 0;
+  }
+  ::close(fd);
+  bridge.connectFd = -1;
+  return -1;
+}
+
+// The TCP handshake is polled across loop() passes so an unreachable cloud
+// never stalls local routing; only MQTT CONNECT/CONNACK runs inline, on an
+// established socket and bounded by the client's socket timeout.
+static void maintainCloud() {
+  if (WiFi.status() != WL_CONNECTED) {
+    if (bridge.connectFd >= 0) {
+      ::close(bridge.connectFd);
+      bridge.connectFd = -1;
+    }
+    return;
+  }
+
+  if (!bridge.ntpStarted) {
+    configTime(0, 0, "pool.ntp.org");
+    bridge.ntpStarted = true;
+  }
+
+  if (cloud.connected()) {
+    cloud.loop();
+    return;
+  }
+  if (bridge.connectFd < 0) {
+    if ((int32_t)(millis() - bridge.nextAttempt) < 0) return;
+    if (!startCloudSocket()) scheduleReconnect(true);
+    return;
+  }
+
+  int socketState = pollCloudSocket();
+  if (socketState == 0) return;
+  if (socketState < 0) {
+    scheduleReconnect(true);
+    Serial.printf("[BRIDGE] Cloud unreachable, retry in ~%lus\n", (unsigned long)(bridge.backoffMs / 1000));
+    return;
+  }
+
+  // PubSubClient skips its own (blocking) connect when the client is already up
+  cloudNet = WiFiClient(bridge.connectFd);
+  bridge.connectFd = -1;
+  String clientId = "veahub-" + String((uint32_t)ESP.getEfuseMac(), HEX);
+  if (cloud.connect(clientId.c_str())) {
+    Serial.printf("[BRIDGE] Connected to %s, %lu batches spooled\n",
+                  CLOUD_BROKER_HOST, (unsigned long)(bridge.nextSeq - bridge.oldestSeq));
+    scheduleReconnect(false);
+    bridge.lastRefill = millis();
+  } else {
+    scheduleReconnect(true);
+    Serial.printf("[BRIDGE] Cloud connect failed (state %d), retry in ~%lus\n",
+                  cloud.state(), (unsigned long)(bridge.backoffMs / 1000));
+  }
+}
+
+// Joins the home network alongside the AP, or leaves it
+void applyBridgeConfig() {
+  parseBridgeTopics();
+  cloud.disconnect();
+
+  if (bridgeConfig.enabled && bridgeConfig.ssid.length() > 0) {
+    // The AP follows the station's channel; devices reassociate once if it changes
+    WiFi.mode(WIFI_AP_STA);
+    WiFi.begin(bridgeConfig.ssid.c_str(), bridgeConfig.password.c_str());
+    Serial.printf("[BRIDGE] Uplink via %s, %u topic filters\n", bridgeConfig.ssid.c_str(), bridgeConfig.filterCount);
+  } else {
+    WiFi.disconnect();
+    WiFi.mode(WIFI_AP);
+  }
+}
+
+void initBridge() {
+  bridge.bootId = prefs.getUInt("bootId", 0) + 1;
+  prefs.putUInt("bootId", bridge.bootId);
+
+  bridge.fsReady = LittleFS.begin(true);
+  if (bridge.fsReady) {
+    scanSpool();
+  } else {
+    Serial.println("[BRIDGE] LittleFS unavailable, offline messages will be dropped");
+  }
+
+  cloud.setServer(CLOUD_BROKER_HOST, CLOUD_BROKER_PORT);
+  cloud.setBufferSize(1536);   // Fits the home summary
+  cloud.setKeepAlive(15);
+  cloud.setSocketTimeout(2);   // Bounds the inline CONNACK wait
+
+  // First attempt is jittered too, for hubs powering up together
+  bridge.nextAttempt = millis() + esp_random() % (5 * BRIDGE_BACKOFF_MIN_MS);
+
+  loadBridgeConfig();
+  applyBridgeConfig();
+}
+
+void serviceBridge() {
+  if (!bridgeConfig.enabled) return;
+
+  maintainCloud();
+
+  if (cloud.connected()) {
+    closeBatch();     // Anything staged joins the backlog, in order
+    drainSpool();
+  } else if (bridge.batchRecords > 0 && millis() - bridge.batchStarted > SPOOL_BATCH_MAX_AGE_MS) {
+    closeBatch();
+  }
+}
+
+// GET /api/bridge
+void handleApiBridge() {
+  StaticJsonDocument<512> doc;
+  doc["enabled"] = bridgeConfig.enabled;
+  doc["ssid"] = bridgeConfig.ssid.c_str();
+  doc["topics"] = bridgeConfig.topics.c_str();
+  doc["uplink"] = WiFi.status() == WL_CONNECTED;
+  doc["cloud"] = cloud.connected();
+  doc["broker"] = CLOUD_BROKER_HOST;
+  doc["spoolBatches"] = bridge.nextSeq - bridge.oldestSeq;
+  doc["spoolBytes"] = bridge.spoolBytes;
+  doc["staged"] = bridge.batchRecords;
+  doc["forwarded"] = bridge.forwarded;
+  doc["spooled"] = bridge.spooled;
+  doc["replayed"] = bridge.replayed;
+  doc["dropped"] = bridge.dropped;
+
+  ChunkWriter out(webServer);
+  out.begin(200, "application/json");
+  serializeJson(doc, out);
+  out.end();
+}
+
+// POST /bridge (enabled, ssid, password, topics); an empty password keeps the old one
+void handleBridge() {
+  bridgeConfig.enabled = webServer.arg("enabled") == "on" || webServer.arg("enabled") == "1";
+  bridgeConfig.ssid = webServer.arg("ssid");
+  if (webServer.arg("password").length() > 0) bridgeConfig.password = webServer.arg("password");
+  bridgeConfig.topics = webServer.hasArg("topics") && webServer.arg("topics").length() > 0
+                          ? webServer.arg("topics") : String(BRIDGE_DEFAULT_TOPICS);
+
+  saveBridgeConfig();
+  applyBridgeConfig();
+
+  webServer.sendHeader("Location", "/");
+  webServer.send(303);
+}
+
+// -------------------------------------------------------------
+// Telemetry Archive
+// -------------------------------------------------------------
+// Block:  "VA1" | flags | bootId (4) | baseTs (4) | records (2) | keyCount | 0 | keys | records
+// Key:    length | chars
+// Record: key index | ts delta-of-delta | field mask | value delta per field in mask
+// All record numbers are varints; signed ones are zigzag coded first.
+static const uint8_t ARCHIVE_MAGIC[3] = { 'V', 'A', '1' };
+static const size_t ARCHIVE_HEADER_BYTES = 16;
+static const size_t ARCHIVE_MAX_RECORD = 1 + 5 + 1 + 5 * HISTORY_FIELD_COUNT;
+
+// One whole block as stored: header, key table, records
+static uint8_t archiveScratch[ARCHIVE_HEADER_BYTES + ARCHIVE_BLOCK_DEVICES * MAX_KEY_LEN + ARCHIVE_BLOCK_BYTES];
+
+static inline uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static size_t putVarint(uint8_t* p, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+// Returns false if the varint runs past end
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+  v = 0;
+  for (int shift = 0; shift < 35 && p < end; shift += 7) {
+    uint8_t b = *p++;
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+static String archivePath(uint32_t seq, bool index) {
+  char path[32];
+  snprintf(path, sizeof(path), "%s/%08lu%s", ARCHIVE_DIR, (unsigned long)seq, index ? ".idx" : "");
+  return String(path);
+}
+
+// Finds the segments left from earlier boots; the newest keeps being appended to
+static void scanArchive() {
+  File dir = LittleFS.open(ARCHIVE_DIR);
+  if (!dir || !dir.isDirectory()) {
+    LittleFS.mkdir(ARCHIVE_DIR);
+    return;
+  }
+
+  bool any = false;
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    const char* name = strrchr(f.name(), '/');
+    uint32_t seq = strtoul(name ? name + 1 : f.name(), nullptr, 10);
+    archive.bytes += f.size();
+    if (!any || seq < archive.oldestSeq) archive.oldestSeq = seq;
+    if (!any || seq >= archive.nextSeq) archive.nextSeq = seq + 1;
+    any = true;
+  }
+
+  if (any) {
+    File newest = LittleFS.open(archivePath(archive.nextSeq - 1, false), FILE_READ);
+    if (newest) {
+      archive.segmentBytes = newest.size();
+      newest.close();
+    }
+  }
+}
+
+static void dropOldestSegment() {
+  for (int index = 0; index < 2; index++) {
+    String path = archivePath(archive.oldestSeq, index);
+    File f = LittleFS.open(path, FILE_READ);
+    if (f) {
+      archive.bytes -= min(archive.bytes, (size_t)f.size());
+      f.close();
+    }
+    LittleFS.remove(path);
+  }
+  archive.oldestSeq++;
+}
+
+static void resetArchiveBlock() {
+  for (uint8_t i = 0; i < archive.blockDeviceCount; i++) {
+    archive.series[archive.blockDevices[i]].keyIndex = NO_ID;
+  }
+  archive.blockDeviceCount = 0;
+  archive.blockLen = 0;
+  archive.blockRecords = 0;
+}
+
+// Appends the open block to the newest segment and indexes it
+static void flushArchiveBlock() {
+  if (archive.blockRecords == 0) return;
+
+  uint8_t* p = archiveScratch;
+  memcpy(p, ARCHIVE_MAGIC, 3);
+  p[3] = archive.blockFlags;
+  memcpy(p + 4, &bridge.bootId, 4);
+  memcpy(p + 8, &archive.blockBaseTs, 4);
+  memcpy(p + 12, &archive.blockRecords, 2);
+  p[14] = archive.blockDeviceCount;
+  p[15] = 0;
+  p += ARCHIVE_HEADER_BYTES;
+  for (uint8_t i = 0; i < archive.blockDeviceCount; i++) {
+    const char* key = deviceStates[archive.blockDevices[i]].key;
+    size_t n = strlen(key);
+    *p++ = n;
+    memcpy(p, key, n);
+    p += n;
+  }
+  memcpy(p, archive.block, archive.blockLen);
+  size_t length = p + archive.blockLen - archiveScratch;
+
+  if (archive.nextSeq == archive.oldestSeq || archive.segmentBytes + length > ARCHIVE_SEGMENT_BYTES) {
+    archive.nextSeq++;
+    archive.segmentBytes = 0;
+  }
+  while (archive.oldestSeq + 1 < archive.nextSeq &&
+         archive.bytes + length + sizeof(ArchiveIndexEntry) > ARCHIVE_MAX_BYTES) {
+    dropOldestSegment();
+  }
+
+  uint32_t seq = archive.nextSeq - 1;
+  File data = LittleFS.open(archivePath(seq, false), FILE_APPEND);
+  File index = LittleFS.open(archivePath(seq, true), FILE_APPEND);
+  if (data && index) {
+    ArchiveIndexEntry entry = { archive.blockMinTs, archive.blockMaxTs, bridge.bootId,
+                                (uint32_t)data.size(), (uint16_t)length, archive.blockFlags, 0 };
+    if (data.write(archiveScratch, length) == length &&
+        index.write((const uint8_t*)&entry, sizeof(entry)) == sizeof(entry)) {
+      archive.bytes += length + sizeof(entry);
+      archive.blocksWritten++;
+    } else {
+      Serial.println("[ARCHIVE] Block write failed");
+    }
+    archive.segmentBytes = data.size();
+  }
+  if (data) data.close();
+  if (index) index.close();
+
+  resetArchiveBlock();
+}
+
+// Appends a device's just-closed 1-minute bucket (the newest row of the tier)
+void archiveBucket(uint8_t device, const HistoryTier& tier) {
+  if (!archive.ready) return;
+
+  const HistoryBucket* row = tier.row(tier.count - 1);
+  uint32_t ts = tier.rowStart(tier.count - 1);
+  uint8_t flags = 0;
+  if (clockSynced()) {
+    ts += (uint32_t)time(nullptr) - millis() / 1000;
+    flags = RECORD_EPOCH;
+  }
+
+  ArchiveSeries& series = archive.series[device];
+  if (archive.blockRecords > 0 &&
+      (flags != archive.blockFlags || archive.blockLen + ARCHIVE_MAX_RECORD > ARCHIVE_BLOCK_BYTES ||
+       (series.keyIndex == NO_ID && archive.blockDeviceCount == ARCHIVE_BLOCK_DEVICES))) {
+    flushArchiveBlock();
+  }
+  if (archive.blockRecords == 0) {
+    archive.blockFlags = flags;
+    archive.blockBaseTs = ts;
+    archive.blockMinTs = ts;
+    archive.blockMaxTs = ts;
+    archive.blockStarted = millis();
+  }
+  if (series.keyIndex == NO_ID) {
+    series.keyIndex = archive.blockDeviceCount;
+    archive.blockDevices[archive.blockDeviceCount++] = device;
+    series.lastTs = archive.blockBaseTs;
+    series.lastDelta = 0;
+    memset(series.last, 0, sizeof(series.last));
+  }
+
+  uint8_t* p = archive.block + archive.blockLen;
+  p += putVarint(p, series.keyIndex);
+  int32_t delta = (int32_t)(ts - series.lastTs);
+  p += putVarint(p, zigzag(delta - series.lastDelta));
+  series.lastTs = ts;
+  series.lastDelta = delta;
+
+  uint8_t* mask = p++;
+  *mask = 0;
+  int fields = 0;
+  for (int f = 0; f < HISTORY_FIELD_COUNT; f++) {
+    if (isnan(row[f].mean)) continue;
+    int32_t q = lroundf(row[f].mean * ARCHIVE_SCALE);
+    p += putVarint(p, zigzag(q - series.last[f]));
+    series.last[f] = q;
+    *mask |= 1 << f;
+    fields++;
+  }
+
+  archive.blockLen = p - archive.block;
+  archive.blockRecords++;
+  archive.blockMinTs = min(archive.blockMinTs, ts);
+  archive.blockMaxTs = max(archive.blockMaxTs, ts);
+  archive.records++;
+  archive.rawBytes += 4 + 4 * fields;
+}
+
+// Writes [ts, value] points of one device's field from a block's records
+static void scanArchiveRecords(const uint8_t* p, const uint8_t* end, uint8_t keyIndex, uint32_t baseTs,
+                               int field, uint32_t from, uint32_t to, Print& out, bool& first) {
+  uint32_t ts = baseTs;
+  int32_t delta = 0;
+  int32_t value = 0;
+
+  while (p < end) {
+    uint32_t key, dod;
+    if (!getVarint(p, end, key) || !getVarint(p, end, dod) || p >= end) return;
+    uint8_t mask = *p++;
+    bool mine = key == keyIndex;
+    if (mine) {
+      delta += unzigzag(dod);
+      ts += delta;
+    }
+
+    for (int f = 0; f < 8; f++) {
+      if (!(mask & (1 << f))) continue;
+      uint32_t zz;
+      if (!getVarint(p, end, zz)) return;
+      if (mine && f == field) value += unzigzag(zz);
+    }
+
+    if (mine && (mask & (1 << field)) && ts >= from && ts <= to) {
+      out.printf("%s[%lu,%.2f]", first ? "" : ",", (unsigned long)ts, value / ARCHIVE_SCALE);
+      first = false;
+    }
+  }
+}
+
+// Same for a stored block, locating the device in its key table
+static void scanArchiveBlock(const uint8_t* block, size_t length, const char* key, int field,
+                             uint32_t from, uint32_t to, Print& out, bool& first) {
+  if (length < ARCHIVE_HEADER_BYTES || memcmp(block, ARCHIVE_MAGIC, 3) != 0) return;
+
+  uint32_t baseTs;
+  memcpy(&baseTs, block + 8, 4);
+  uint8_t keyCount = block[14];
+  const uint8_t* p = block + ARCHIVE_HEADER_BYTES;
+  const uint8_t* end = block + length;
+
+  uint8_t keyIndex = NO_ID;
+  size_t keyLen = strlen(key);
+  for (uint8_t i = 0; i < keyCount; i++) {
+    if (p >= end || p + 1 + *p > end) return;
+    if (*p == keyLen && memcmp(p + 1, key, keyLen) == 0) keyIndex = i;
+    p += 1 + *p;
+  }
+  if (keyIndex != NO_ID) scanArchiveRecords(p, end, keyIndex, baseTs, field, from, to, out, first);
+}
+
+void initArchive() {
+  for (auto& series : archive.series) {
+    series.keyIndex = NO_ID;
+  }
+
+  archive.ready = bridge.fsReady;   // Mounted by initBridge()
+  if (!archive.ready) return;
+
+  scanArchive();
+  Serial.printf("[ARCHIVE] %lu segments, %u bytes on flash\n",
+                (unsigned long)(archive.nextSeq - archive.oldestSeq), (unsigned)archive.bytes);
+}
+
+void serviceArchive() {
+  if (archive.blockRecords > 0 && millis() - archive.blockStarted > ARCHIVE_BLOCK_MAX_AGE_MS) {
+    flushArchiveBlock();
+  }
+}
+
+// GET /api/archive?device=livingroom&field=temp&from=&to=
+// Times are Unix seconds once the clock is synced (via the bridge's NTP), else
+// seconds since boot; only blocks recorded the same way are searched. The
+// default range is the last 24 h. Each point is [minuteStart, mean].
+void handleApiArchive() {
+  String key = webServer.arg("device");
+  uint8_t device = lookupDevice(key);
+  if (device != NO_ID) key = deviceStates[device].key;   // Else a device not seen since boot
+
+  int field = historyField(webServer.arg("field"));
+  if (key.length() == 0 || field < 0) {
+    webServer.send(400, "application/json", "{\"error\":\"device and field (temp, hum, dust, mq2, alertFlags or rssi) required\"}");
+    return;
+  }
+
+  bool epoch = clockSynced();
+  uint8_t flags = epoch ? RECORD_EPOCH : 0;
+  uint32_t now = epoch ? (uint32_t)time(nullptr) : millis() / 1000;
+  uint32_t to = webServer.hasArg("to") ? webServer.arg("to").toInt() : now;
+  uint32_t from = webServer.hasArg("from") ? webServer.arg("from").toInt() : (to > 86400 ? to - 86400 : 0);
+
+  ChunkWriter out(webServer);
+  out.begin(200, "application/json");
+  out.printf("{\"device\":\"%s\",\"field\":\"%s\",\"epoch\":%s,\"now\":%lu,\"points\":[",
+             key.c_str(), fieldNames[field], epoch ? "true" : "false", (unsigned long)now);
+
+  // One stored block per part; the place is a segment and an index entry
+  uint32_t seq = archive.oldestSeq;
+  uint32_t entryNo = 0;
+  uint32_t blocksRead = 0;
+  bool first = true;
+  webServer.stream([=](ChunkWriter& out) mutable {
+    for (seq = max(seq, archive.oldestSeq); archive.ready && seq < archive.nextSeq; seq++, entryNo = 0) {
+      File index = LittleFS.open(archivePath(seq, true), FILE_READ);
+      if (!index || !index.seek(entryNo * sizeof(ArchiveIndexEntry))) continue;
+
+      ArchiveIndexEntry entry;
+      while (index.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry)) {
+        entryNo++;
+        if (entry.lastTs < from || entry.firstTs > to || entry.flags != flags) continue;
+        if (!epoch && entry.bootId != bridge.bootId) continue;
+        if (entry.length > sizeof(archiveScratch)) continue;
+
+        File data = LittleFS.open(archivePath(seq, false), FILE_READ);
+        if (!data || !data.seek(entry.offset) || data.read(archiveScratch, entry.length) != entry.length) break;
+        scanArchiveBlock(archiveScratch, entry.length, key.c_str(), field, from, to, out, first);
+        blocksRead++;
+        return true;
+      }
+    }
+
+    // The block still in RAM
+    if (device != NO_ID && archive.blockRecords > 0 && archive.blockFlags == flags &&
+        archive.series[device].keyIndex != NO_ID) {
+      scanArchiveRecords(archive.block, archive.block + archive.blockLen, archive.series[device].keyIndex,
+                         archive.blockBaseTs, field, from, to, out, first);
+    }
+
+    out.printf("],\"blocksRead\":%lu}", (unsigned long)blocksRead);
+    return false;
+  });
+}
+
+// -------------------------------------------------------------
+// Metrics
+// -------------------------------------------------------------
+void observeLoopTime(uint32_t us) {
+  int bucket = 0;
+  while (bucket < LOOP_BUCKET_COUNT && us > LOOP_BUCKET_US[bucket]) bucket++;
+  bump(metrics.loopBuckets[bucket]);
+  bump(metrics.loopCount);
+  bump(metrics.loopSumUs, us);
+
+  uint32_t longest = metrics.loopMaxUs.load(std::memory_order_relaxed);
+  if (us > longest) metrics.loopMaxUs.store(us, std::memory_order_relaxed);
+}
+
+static inline uint32_t readCounter(const std::atomic<uint32_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+static void printMetricHeader(Print& out, const char* name, const char* type, const char* help) {
+  out.printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void printMetric(Print& out, const char* name, const char* type, const char* help, uint32_t value) {
+  printMetricHeader(out, name, type, help);
+  out.printf("%s %u\n", name, value);
+}
+
+// Per-client counter, one sample per broker slot
+static void printClientMetric(Print& out, const char* name, const char* help,
+                              std::atomic<uint32_t> ClientMetrics::*field) {
+  printMetricHeader(out, name, "counter", help);
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    out.printf("%s{client=\"%d\"} %u\n", name, i, readCounter(metrics.clients[i].*field));
+  }
+}
+
+// GET /metrics (Prometheus text format)
+void handleMetrics() {
+  ChunkWriter out(webServer);
+  out.begin(200, "text/plain; version=0.0.4");
+
+  printClientMetric(out, "veahub_mqtt_messages_in_total", "Messages received per broker client slot.", &ClientMetrics::messagesIn);
+  printClientMetric(out, "veahub_mqtt_messages_out_total", "Messages forwarded per broker client slot.", &ClientMetrics::messagesOut);
+  printClientMetric(out, "veahub_mqtt_bytes_in_total", "Bytes received per broker client slot.", &ClientMetrics::bytesIn);
+  printClientMetric(out, "veahub_mqtt_bytes_out_total", "Bytes forwarded per broker client slot.", &ClientMetrics::bytesOut);
+  printClientMetric(out, "veahub_mqtt_drops_total", "Forwards the client socket did not accept.", &ClientMetrics::drops);
+
+  printMetricHeader(out, "veahub_mqtt_rx_pending_bytes", "gauge", "Bytes waiting in each client's receive buffer.");
+  int connected = 0;
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    bool up = clientConnected[i] && mqttClients[i].connected();
+    connected += up;
+    out.printf("veahub_mqtt_rx_pending_bytes{client=\"%d\"} %d\n", i, up ? mqttClients[i].available() : 0);
+  }
+  printMetric(out, "veahub_mqtt_clients", "gauge", "Connected broker clients.", connected);
+
+  printMetric(out, "veahub_rules_fired_total", "counter", "Automation rule firings.", readCounter(metrics.rulesFired));
+  printMetric(out, "veahub_rules", "gauge", "Configured automation rules.", automationRules.size());
+  printMetric(out, "veahub_json_parse_errors_total", "counter", "Telemetry payloads that failed to parse.", readCounter(metrics.jsonErrors));
+  printMetric(out, "veahub_devices", "gauge", "Devices in the state cache.", deviceCount);
+
+  printMetric(out, "veahub_events_dropped_total", "counter", "SSE frames skipped for lagging listeners.", eventDrops);
+  printMetricHeader(out, "veahub_events_backlog", "gauge", "Frames queued per SSE listener.");
+  for (int i = 0; i < MAX_EVENT_LISTENERS; i++) {
+    const EventListener& listener = eventListeners[i];
+    out.printf("veahub_events_backlog{listener=\"%d\"} %u\n", i, listener.active ? eventHead - listener.cursor : 0);
+  }
+
+  int httpActive = 0;
+  for (int i = 0; i < MAX_HTTP_CONNECTIONS; i++) {
+    httpActive += webServer.connectionActive(i);
+  }
+  printMetric(out, "veahub_http_connections", "gauge", "Open HTTP connection slots.", httpActive);
+  printMetric(out, "veahub_http_requests_total", "counter", "HTTP requests dispatched.", webServer.requestCount);
+  printMetric(out, "veahub_http_rejected_total", "counter", "HTTP connections refused with all slots busy.", webServer.rejectedCount);
+  printMetric(out, "veahub_http_timeouts_total", "counter", "HTTP requests that timed out before completing.", webServer.timeoutCount);
+  printMetric(out, "veahub_http_abandoned_total", "counter", "HTTP responses dropped for a slow or dead reader.", webServer.abandonedCount);
+
+  printMetricHeader(out, "veahub_loop_duration_us", "histogram", "Main loop iteration time, excluding the idle delay.");
+  uint32_t cumulative = 0;
+  for (int i = 0; i < LOOP_BUCKET_COUNT; i++) {
+    cumulative += readCounter(metrics.loopBuckets[i]);
+    out.printf("veahub_loop_duration_us_bucket{le=\"%u\"} %u\n", LOOP_BUCKET_US[i], cumulative);
+  }
+  cumulative += readCounter(metrics.loopBuckets[LOOP_BUCKET_COUNT]);
+  out.printf("veahub_loop_duration_us_bucket{le=\"+Inf\"} %u\n", cumulative);
+  out.printf("veahub_loop_duration_us_sum %u\n", readCounter(metrics.loopSumUs));
+  out.printf("veahub_loop_duration_us_count %u\n", readCounter(metrics.loopCount));
+  printMetric(out, "veahub_loop_duration_max_us", "gauge", "Longest loop iteration since boot.", readCounter(metrics.loopMaxUs));
+
+  printMetric(out, "veahub_bridge_connected", "gauge", "Cloud bridge connection state.", cloud.connected());
+  printMetric(out, "veahub_bridge_forwarded_total", "counter", "Messages republished live to the cloud.", bridge.forwarded);
+  printMetric(out, "veahub_bridge_spooled_total", "counter", "Messages spooled while the cloud was unreachable.", bridge.spooled);
+  printMetric(out, "veahub_bridge_replayed_total", "counter", "Spooled messages delivered after reconnecting.", bridge.replayed);
+  printMetric(out, "veahub_bridge_dropped_total", "counter", "Messages lost to a full or unavailable spool.", bridge.dropped);
+  printMetric(out, "veahub_bridge_spool_bytes", "gauge", "Compressed backlog on flash.", bridge.spoolBytes);
+
+  printMetric(out, "veahub_archive_bytes", "gauge", "Telemetry archive size on flash.", archive.bytes);
+  printMetric(out, "veahub_archive_records_total", "counter", "1-minute records archived.", archive.records);
+  printMetric(out, "veahub_archive_raw_bytes_total", "counter", "Archived records as fixed-width rows, before encoding.", archive.rawBytes);
+  printMetric(out, "veahub_archive_blocks_written_total", "counter", "Archive blocks written to flash.", archive.blocksWritten);
+
+  printMetric(out, "veahub_heap_free_bytes", "gauge", "Free heap.", ESP.getFreeHeap());
+  printMetric(out, "veahub_heap_min_free_bytes", "gauge", "Lowest free heap since boot.", ESP.getMinFreeHeap());
+  printMetric(out, "veahub_heap_largest_block_bytes", "gauge", "Largest allocatable heap block.", ESP.getMaxAllocHeap());
+  printMetric(out, "veahub_uptime_seconds", "counter", "Seconds since boot.", millis() / 1000);
+
+  out.end();
+}
+
+// -------------------------------------------------------------
+// Persistence
+// -------------------------------------------------------------
+void loadDeviceAliases() {
+  int count = prefs.getInt("aliasCount", 0);
+  for (int i = 0; i < count; i++) {
+    String key = "alias" + String(i);
+    String data = prefs.getString(key.c_str(), "");
+
+    // Format: name|deviceKey[|room]
+    int separator = data.indexOf('|');
+    if (separator > 0) {
+      DeviceAlias alias;
+      alias.name = data.substring(0, separator);
+      alias.deviceKey = data.substring(separator + 1);
+      int roomSeparator = alias.deviceKey.indexOf('|');
+      if (roomSeparator >= 0) {
+        alias.room = alias.deviceKey.substring(roomSeparator + 1);
+        alias.deviceKey = alias.deviceKey.substring(0, roomSeparator);
+      }
+      deviceAliases.push_back(alias);
+    }
+  }
+}
+
+void saveDeviceAliases() {
+  prefs.putInt("aliasCount", deviceAliases.size());
+  for (size_t i = 0; i < deviceAliases.size(); i++) {
+    String key = "alias" + String(i);
+    String data = deviceAliases[i].name + "|" + deviceAliases[i].deviceKey;
+    if (deviceAliases[i].room.length() > 0) data += "|" + deviceAliases[i].room;
+    prefs.putString(key.c_str(), data);
+  }
+}
+
+void loadBridgeConfig() {
+  bridgeConfig.enabled = prefs.getBool("bridgeOn", false);
+  bridgeConfig.ssid = prefs.getString("bridgeSsid", "");
+  bridgeConfig.password = prefs.getString("bridgePass", "");
+  bridgeConfig.topics = prefs.getString("bridgeTopics", BRIDGE_DEFAULT_TOPICS);
+}
+
+void saveBridgeConfig() {
+  prefs.putBool("bridgeOn", bridgeConfig.enabled);
+  prefs.putString("bridgeSsid", bridgeConfig.ssid);
+  prefs.putString("bridgePass", bridgeConfig.password);
+  prefs.putString("bridgeTopics", bridgeConfig.topics);
+}
+
+void loadAutomationRules() {
+  int count = prefs.getInt("ruleCount", 0);
+  for (int i = 0; i < count; i++) {
+    String key = "rule" + String(i);
+    String data = prefs.getString(key.c_str(), "");
+    if (data.length() > 0) {
+      // Parse stored rule (simplified)
+      // Format: enabled|source|condition|target|payload
+      // TODO: Implement proper parsing
+    }
+  }
+}
+
+void saveAutomationRules() {
+  prefs.putInt("ruleCount", automationRules.size());
+  for (size_t i = 0; i < automationRules.size(); i++) {
+    String key = "rule" + String(i);
+    // TODO: Serialize rule to string
+    // prefs.putString(key.c_str(), serialized);
+  }
 }
 
 // -------------------------------------------------------------
 // Loop
 // -------------------------------------------------------------
 void loop() {
+  uint32_t started = micros();
+
   dnsServer.processNextRequest();
   webServer.handleClient();
   handleMQTT();
-  
+  pumpEventStreams();
+  serviceBridge();
+  serviceArchive();
+  sweepPresence();
+  sweepHistory();
+  serviceSummary();
+
+  observeLoopTime(micros() - started);
   delay(1);
 }